@@ -194,6 +194,13 @@ bool DirectX11::InitWindowAndDevice(ovrRecti vp, const LUID* pLuid) {
     return true;
 }
 
+void DirectX11::collectResources(uint64_t completedFrame) {
+    // Pipeline state objects first, freeing them releases their handles to state objects
+    pipelineStateObjectManager->collect(completedFrame);
+    stateManagers->collect(completedFrame);
+    texture2DManager.collect(completedFrame);
+}
+
 void DirectX11::HandleMessages() {
     MSG msg;
     if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
@@ -77,6 +77,8 @@ struct DirectX11 {
     void ClearAndSetRenderTarget(ID3D11RenderTargetView* rendertarget, ID3D11DepthStencilView* dsv);
     void setViewport(const ovrRecti& vp);
     void HandleMessages();
+    // Free resources no longer referenced since a few frames before completedFrame
+    void collectResources(uint64_t completedFrame);
 
     void applyState(ID3D11DeviceContext& context, PipelineStateObject& pso);
 private:
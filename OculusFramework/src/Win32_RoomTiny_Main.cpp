@@ -32,6 +32,7 @@ limitations under the License.
 #include "OVR_CAPI_D3D.h"  // Include SDK-rendered code for the D3D version
 #pragma warning(pop)
 
+#include "filewatcher.h"
 #include "frp.h"
 #include "libovrwrapper.h"
 #include "pipelinestateobject.h"
@@ -504,7 +505,11 @@ int WINAPI WinMain(_In_ HINSTANCE hinst, _In_opt_ HINSTANCE, _In_ LPSTR args, _I
         return Vec3f{9.0f * to<float>(sin(0.75 * t)), 3.0f, 9.0f * to<float>(cos(0.75 * t))};
     });
 
+    // Shaders are loaded from the working directory
+    FileWatcher shaderWatcher{"."};
+
     // Main update loop
+    auto frameIndex = uint64_t{0};
     while (!(DX11.Key['Q'] && DX11.Key[VK_CONTROL])) {
         const auto frameTimeS = hmd->getTimeInSeconds();
         DX11.HandleMessages();
@@ -515,11 +520,9 @@ int WINAPI WinMain(_In_ HINSTANCE hinst, _In_opt_ HINSTANCE, _In_ LPSTR args, _I
         // Handle key toggles for re-centering, meshes, FOV, etc.
         ExampleFeatures1(DX11, *hmd, useHmdToEyeViewOffset);
 
-        // Reload shaders
-        if (DX11.Key['H']) {
-            DX11.stateManagers->vertexShaderManager.recreateAll();
-            DX11.stateManagers->pixelShaderManager.recreateAll();
-        }
+        // Reload shaders whose source files have been saved
+        const auto changedFiles = shaderWatcher.changedFiles();
+        if (!changedFiles.empty()) DX11.stateManagers->reloadShaders(changedFiles);
 
         // process input
         {
@@ -600,6 +603,8 @@ int WINAPI WinMain(_In_ HINSTANCE hinst, _In_opt_ HINSTANCE, _In_ LPSTR args, _I
         // Copy mirror texture to back buffer
         DX11.Context->CopyResource(DX11.BackBuffer.Get(), mirrorTexture.d3dTexture());
         DX11.SwapChain->Present(0, 0);
+
+        DX11.collectResources(frameIndex++);
     }
 
     return 0;
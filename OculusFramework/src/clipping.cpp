@@ -0,0 +1,123 @@
+#include "clipping.h"
+
+#include <utility>
+
+using namespace std;
+
+using namespace mathlib;
+
+namespace {
+
+// Liang-Barsky: find the parametric range [t0, t1] of a + (b - a) * t inside the rectangle
+bool clipSegmentParams(const Vec2f& a, const Vec2f& b, const Vec2f& minCorner,
+                       const Vec2f& maxCorner, float& t0, float& t1) {
+    const auto d = b - a;
+    t0 = 0.0f;
+    t1 = 1.0f;
+    // Each boundary as p * t <= q, p < 0 means the segment is entering across it
+    const float ps[] = {-d.x(), d.x(), -d.y(), d.y()};
+    const float qs[] = {a.x() - minCorner.x(), maxCorner.x() - a.x(), a.y() - minCorner.y(),
+                        maxCorner.y() - a.y()};
+    for (int i = 0; i < 4; ++i) {
+        if (ps[i] == 0.0f) {
+            if (qs[i] < 0.0f) return false;  // parallel to and outside this boundary
+            continue;
+        }
+        const auto t = qs[i] / ps[i];
+        if (ps[i] < 0.0f) {
+            if (t > t1) return false;
+            if (t > t0) t0 = t;
+        } else {
+            if (t < t0) return false;
+            if (t < t1) t1 = t;
+        }
+    }
+    return true;
+}
+
+float coord(const Vec2f& p, int axis) { return axis == 0 ? p.x() : p.y(); }
+
+}  // namespace
+
+bool clipSegment(Vec2f& a, Vec2f& b, const Vec2f& minCorner, const Vec2f& maxCorner) {
+    auto t0 = 0.0f;
+    auto t1 = 1.0f;
+    if (!clipSegmentParams(a, b, minCorner, maxCorner, t0, t1)) return false;
+    const auto d = b - a;
+    const auto start = a;
+    if (t0 > 0.0f) a = start + d * t0;
+    if (t1 < 1.0f) b = start + d * t1;
+    return true;
+}
+
+vector<vector<Vec2f>> clipPolyline(gsl::array_view<const Vec2f> points, const Vec2f& minCorner,
+                                   const Vec2f& maxCorner) {
+    auto res = vector<vector<Vec2f>>{};
+    auto run = vector<Vec2f>{};
+    const auto endRun = [&res, &run] {
+        if (run.size() >= 2) res.push_back(move(run));
+        run.clear();
+    };
+    for (size_t i = 1; i < points.size(); ++i) {
+        const auto& a = points[i - 1];
+        const auto& b = points[i];
+        auto t0 = 0.0f;
+        auto t1 = 1.0f;
+        if (!clipSegmentParams(a, b, minCorner, maxCorner, t0, t1)) {
+            endRun();
+            continue;
+        }
+        // A clipped start means the polyline re-entered the rectangle so starts a new run
+        if (run.empty() || t0 > 0.0f) {
+            endRun();
+            run.push_back(t0 > 0.0f ? a + (b - a) * t0 : a);
+        }
+        run.push_back(t1 < 1.0f ? a + (b - a) * t1 : b);
+        if (t1 < 1.0f) endRun();
+    }
+    endRun();
+    return res;
+}
+
+vector<Vec2f> clipRing(gsl::array_view<const Vec2f> ring, const Vec2f& minCorner,
+                       const Vec2f& maxCorner) {
+    auto input = vector<Vec2f>(begin(ring), end(ring));
+    // Shapefile rings repeat the first point at the end, the clipper treats rings as implicitly
+    // closed so drop it to avoid a zero length edge
+    if (input.size() > 1 && input.front().x() == input.back().x() &&
+        input.front().y() == input.back().y())
+        input.pop_back();
+    auto output = vector<Vec2f>{};
+
+    // Clip against each boundary in turn: axis 0 or 1, keeping the side >= or <= bound
+    for (int edge = 0; edge < 4 && !input.empty(); ++edge) {
+        const auto axis = edge / 2;
+        const auto isMin = edge % 2 == 0;
+        const auto bound = coord(isMin ? minCorner : maxCorner, axis);
+        const auto inside = [=](const Vec2f& p) {
+            return isMin ? coord(p, axis) >= bound : coord(p, axis) <= bound;
+        };
+        const auto intersect = [=](const Vec2f& p, const Vec2f& q) {
+            const auto t = (bound - coord(p, axis)) / (coord(q, axis) - coord(p, axis));
+            const auto res = p + (q - p) * t;
+            // Snap to the boundary so rounding can't leave the point fractionally outside
+            return axis == 0 ? Vec2f{bound, res.y()} : Vec2f{res.x(), bound};
+        };
+        output.clear();
+        auto prev = input.back();
+        for (const auto& curr : input) {
+            if (inside(curr)) {
+                if (!inside(prev)) output.push_back(intersect(prev, curr));
+                output.push_back(curr);
+            } else if (inside(prev)) {
+                output.push_back(intersect(prev, curr));
+            }
+            prev = curr;
+        }
+        swap(input, output);
+    }
+
+    if (input.size() < 3) return {};
+    input.push_back(input.front());
+    return input;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "vector.h"
+
+#pragma warning(push)
+#pragma warning(disable : 4245)
+#include <array_view.h>
+#pragma warning(pop)
+
+#include <vector>
+
+// Clipping of 2D vector geometry against an axis aligned rectangle, used to trim shapefile layers
+// to the terrain extent before they are reprojected and rendered.
+
+// Liang-Barsky clip of the segment a-b. Returns false if it lies entirely outside, otherwise
+// updates a and b to the visible portion.
+bool clipSegment(mathlib::Vec2f& a, mathlib::Vec2f& b, const mathlib::Vec2f& minCorner,
+                 const mathlib::Vec2f& maxCorner);
+
+// Clip an open polyline. Each run of the polyline inside the rectangle becomes a separate
+// polyline in the result, runs of fewer than 2 points are dropped.
+std::vector<std::vector<mathlib::Vec2f>> clipPolyline(gsl::array_view<const mathlib::Vec2f> points,
+                                                      const mathlib::Vec2f& minCorner,
+                                                      const mathlib::Vec2f& maxCorner);
+
+// Sutherland-Hodgman clip of a closed ring. The result is a single ring which may contain
+// degenerate edges along the rectangle boundary where a concave ring is split, this is harmless
+// for filling. Returns an empty ring if fewer than 3 points remain.
+std::vector<mathlib::Vec2f> clipRing(gsl::array_view<const mathlib::Vec2f> ring,
+                                     const mathlib::Vec2f& minCorner,
+                                     const mathlib::Vec2f& maxCorner);
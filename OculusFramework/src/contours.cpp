@@ -0,0 +1,209 @@
+#include "contours.h"
+
+#include "simplify.h"
+#include "threadpool.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+using namespace mathlib;
+using namespace util;
+
+namespace {
+
+// Cells per side of the blocks extraction is split into
+const auto blockSize = 64;
+
+// Crossings are identified by the grid edge they lie on, shared by the cells either side of it:
+// 2 * sample index for the edge to a sample's right and 2 * sample index + 1 for the edge below.
+// A segment joins the crossings on two edges of a cell.
+struct Segment {
+    int level;
+    int64_t fromEdge;
+    int64_t toEdge;
+};
+
+class ContourGrid {
+public:
+    ContourGrid(gsl::array_view<const uint16_t> heights, int width, float interval)
+        : samples(heights), gridWidth{width}, contourInterval{interval} {}
+
+    float at(int x, int y) const { return samples[size_t(y) * gridWidth + x]; }
+    float levelHeight(int level) const { return level * contourInterval; }
+    // Contours with min < height <= max, so each has a sample below and one at or above it
+    int firstLevel(float min) const { return to<int>(floor(min / contourInterval)) + 1; }
+    int lastLevel(float max) const { return to<int>(floor(max / contourInterval)); }
+
+    int64_t rightEdge(int x, int y) const { return 2 * (int64_t(y) * gridWidth + x); }
+    int64_t downEdge(int x, int y) const { return rightEdge(x, y) + 1; }
+
+    // pixPositions of level's crossing on edge
+    Vec2f crossing(int64_t edge, int level) const {
+        const auto sample = edge / 2;
+        const auto x = static_cast<int>(sample % gridWidth);
+        const auto y = static_cast<int>(sample / gridWidth);
+        const auto x1 = edge % 2 ? x : x + 1;
+        const auto y1 = edge % 2 ? y + 1 : y;
+        const auto h0 = at(x, y);
+        const auto t = (levelHeight(level) - h0) / (at(x1, y1) - h0);
+        return {x + (x1 - x) * t + 0.5f, y + (y1 - y) * t + 0.5f};
+    }
+
+    // Append the segments of the cells in [x0, x1) x [y0, y1) to segments
+    void extractBlock(int x0, int y0, int x1, int y1, vector<Segment>& segments) const;
+
+private:
+    gsl::array_view<const uint16_t> samples;
+    int gridWidth;
+    float contourInterval;
+};
+
+void ContourGrid::extractBlock(int x0, int y0, int x1, int y1, vector<Segment>& segments) const {
+    // Skip the block if no contour crosses it
+    auto blockMin = at(x0, y0);
+    auto blockMax = blockMin;
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            blockMin = min(blockMin, at(x, y));
+            blockMax = max(blockMax, at(x, y));
+        }
+    }
+    if (firstLevel(blockMin) > lastLevel(blockMax)) return;
+
+    struct Crossing {
+        int64_t edge;
+        // Whether going clockwise round the cell crosses from below the contour to above it
+        bool up;
+    };
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            // Corners and the edges between them clockwise from the top left
+            const float h[] = {at(x, y), at(x + 1, y), at(x + 1, y + 1), at(x, y + 1)};
+            const int64_t edges[] = {rightEdge(x, y), downEdge(x + 1, y), rightEdge(x, y + 1),
+                                     downEdge(x, y)};
+            const auto cellMin = min({h[0], h[1], h[2], h[3]});
+            const auto cellMax = max({h[0], h[1], h[2], h[3]});
+            for (int level = firstLevel(cellMin); level <= lastLevel(cellMax); ++level) {
+                const auto levelH = levelHeight(level);
+                Crossing crossings[4];
+                auto numCrossings = 0;
+                for (int i = 0; i < 4; ++i) {
+                    const auto above = h[i] >= levelH;
+                    if (above != (h[(i + 1) % 4] >= levelH))
+                        crossings[numCrossings++] = {edges[i], !above};
+                }
+                if (numCrossings == 2) {
+                    // Segments run from the up crossing to the down one, keeping higher ground
+                    // on the left
+                    const auto up = crossings[0].up ? 0 : 1;
+                    segments.push_back({level, crossings[up].edge, crossings[1 - up].edge});
+                } else if (numCrossings == 4) {
+                    // Saddle, join the crossings so the corners on the other side of the contour
+                    // from the cell's center are cut off
+                    const auto centerAbove = (h[0] + h[1] + h[2] + h[3]) * 0.25f >= levelH;
+                    for (int i = 0; i < 4; ++i) {
+                        if (!crossings[i].up) continue;
+                        const auto down = centerAbove ? (i + 3) % 4 : (i + 1) % 4;
+                        segments.push_back({level, crossings[i].edge, crossings[down].edge});
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Join one level's segments into polylines and add them to layer
+void joinSegments(const ContourGrid& grid, int level, const vector<Segment>& segments,
+                  const function<Vec2f(const Vec2f&)>& pixToLatLong, VectorLayer& layer) {
+    // Each crossing starts at most one segment and ends at most one so the segments form chains
+    auto starts = vector<pair<int64_t, int>>(segments.size());
+    for (size_t i = 0; i < segments.size(); ++i) starts[i] = {segments[i].fromEdge, to<int>(i)};
+    sort(begin(starts), end(starts));
+    auto next = vector<int>(segments.size(), -1);
+    auto hasPrevious = vector<bool>(segments.size(), false);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const auto s = lower_bound(begin(starts), end(starts), make_pair(segments[i].toEdge, 0));
+        if (s == end(starts) || s->first != segments[i].toEdge) continue;
+        next[i] = s->second;
+        hasPrevious[s->second] = true;
+    }
+
+    auto elevation = ostringstream{};
+    elevation << grid.levelHeight(level);
+    auto visited = vector<bool>(segments.size(), false);
+    auto points = vector<Vec2f>{};
+    const auto addChain = [&](int first) {
+        points.assign(1, grid.crossing(segments[first].fromEdge, level));
+        for (auto i = first; i >= 0 && !visited[i]; i = next[i]) {
+            visited[i] = true;
+            points.push_back(grid.crossing(segments[i].toEdge, level));
+        }
+        layer.beginShape();
+        layer.addAttribute(elevation.str());
+        const auto part = layer.addPart(to<int>(points.size()));
+        for (size_t i = 0; i < points.size(); ++i) {
+            part.pixPositions[i] = points[i];
+            part.latLongs[i] = pixToLatLong(points[i]);
+        }
+        polylineSignificance(part.pixPositions, part.significance);
+    };
+    // Open chains from their start, which reach the grid edge, then the remaining closed loops
+    for (size_t i = 0; i < segments.size(); ++i)
+        if (!hasPrevious[i]) addChain(to<int>(i));
+    for (size_t i = 0; i < segments.size(); ++i)
+        if (!visited[i]) addChain(to<int>(i));
+}
+
+}  // namespace
+
+VectorLayer extractContours(gsl::array_view<const uint16_t> heights, int width, int height,
+                            float interval, const function<Vec2f(const Vec2f&)>& pixToLatLong) {
+    if (width < 2 || height < 2 || heights.size() != size_t(width) * height)
+        throw runtime_error{"Bad heightfield size for contour extraction"};
+    if (!(interval > 0.0f)) throw runtime_error{"Contour interval must be positive"};
+    const auto grid = ContourGrid{heights, width, interval};
+
+    // Segments of each block of cells
+    const auto blocksX = (width - 1 + blockSize - 1) / blockSize;
+    const auto blocksY = (height - 1 + blockSize - 1) / blockSize;
+    auto blockSegments = vector<vector<Segment>>(size_t(blocksX) * blocksY);
+    ThreadPool::global().parallelFor(to<int>(blockSegments.size()), 1, [&](int first, int last) {
+        for (auto i = first; i < last; ++i) {
+            const auto x0 = i % blocksX * blockSize;
+            const auto y0 = i / blocksX * blockSize;
+            grid.extractBlock(x0, y0, min(x0 + blockSize, width - 1),
+                              min(y0 + blockSize, height - 1), blockSegments[i]);
+        }
+    });
+
+    // Group them by level, joining them into polylines works on each level independently
+    auto minHeight = heights[0];
+    auto maxHeight = heights[0];
+    for (const auto h : heights) {
+        minHeight = min(minHeight, h);
+        maxHeight = max(maxHeight, h);
+    }
+    const auto firstLevel = grid.firstLevel(minHeight);
+    const auto numLevels = max(grid.lastLevel(maxHeight) - firstLevel + 1, 0);
+    auto levelSegments = vector<vector<Segment>>(numLevels);
+    for (const auto& segments : blockSegments)
+        for (const auto& s : segments) levelSegments[s.level - firstLevel].push_back(s);
+    blockSegments.clear();
+
+    const auto attributeNames = vector<string>{"elevation"};
+    auto levelLayers = vector<VectorLayer>(numLevels, VectorLayer{attributeNames});
+    ThreadPool::global().parallelFor(numLevels, 1, [&](int first, int last) {
+        for (auto i = first; i < last; ++i)
+            joinSegments(grid, firstLevel + i, levelSegments[i], pixToLatLong, levelLayers[i]);
+    });
+
+    auto res = VectorLayer{attributeNames};
+    for (const auto& layer : levelLayers) res.append(layer);
+    return res;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "vectorlayer.h"
+
+#include "vector.h"
+
+#pragma warning(push)
+#pragma warning(disable : 4245)
+#include <array_view.h>
+#pragma warning(pop)
+
+#include <cstdint>
+#include <functional>
+
+// Contour lines of a heightfield by marching squares. Sample (x, y) of heights, stored row by
+// row, is at pixPositions (x + 0.5, y + 0.5) like the terrain's vertices. The cells between
+// samples are processed in square blocks on the global thread pool, blocks whose height range no
+// contour crosses are skipped and the segments of each contour are then joined across blocks
+// into polylines.
+//
+// The result is an arc layer with an "elevation" attribute holding the contour's height, one
+// shape per polyline. Polylines are oriented with higher ground on their left, with y down as in
+// pixPositions, and closed ones repeat their first point at the end. latLongs come from
+// pixToLatLong, which is called from pool threads.
+VectorLayer extractContours(
+    gsl::array_view<const std::uint16_t> heights, int width, int height, float interval,
+    const std::function<mathlib::Vec2f(const mathlib::Vec2f&)>& pixToLatLong);
@@ -99,6 +99,11 @@ constexpr DXGI_FORMAT getDXGIFormat<mathlib::Vec3f>() {
     return DXGI_FORMAT_R32G32B32_FLOAT;
 }
 
+template <>
+constexpr DXGI_FORMAT getDXGIFormat<mathlib::Vec4f>() {
+    return DXGI_FORMAT_R32G32B32A32_FLOAT;
+}
+
 // Helpers to build input layouts
 
 constexpr auto makeInputElementDescHelper(
@@ -17,3 +17,12 @@ Texture2DManager::ResourceType* Texture2DManager::createResource(
     return srv;
 }
 
+Texture2DManager::ResourceType* Texture2DManager::createPlaceholder() {
+    // Mid grey, shown while textures load
+    const auto grey = uint32_t{0xff808080};
+    auto tex = CreateTexture2D(
+        device.Get(), Texture2DDesc{DXGI_FORMAT_R8G8B8A8_UNORM, 1, 1}.mipLevels(1),
+        {&grey, sizeof(grey)}, "Texture2DManager::placeholder");
+    return CreateShaderResourceView(device.Get(), tex.Get(), "Texture2DManager::placeholder")
+        .Detach();
+}
@@ -19,6 +19,11 @@ protected:
 
 using Texture2DKey = std::string;
 class Texture2DManager : public D3DObjectManagerBase<Texture2DKey, ID3D11ShaderResourceView> {
+public:
+    ~Texture2DManager() override { finishPendingLoads(); }
+
+private:
     ResourceType* createResource(const KeyType& key) override;
+    ResourceType* createPlaceholder() override;
 };
 
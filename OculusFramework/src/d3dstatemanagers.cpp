@@ -100,6 +100,7 @@ public:
         *ppData = str.c_str();
         *pBytes = str.size();
         bufs_[*ppData] = move(str);
+        includedFiles_.push_back(pFileName);
         return S_OK;
     }
     STDMETHOD(Close)(LPCVOID pData) override {
@@ -109,8 +110,11 @@ public:
         return S_OK;
     }
 
+    const vector<string>& includedFiles() const { return includedFiles_; }
+
 private:
     std::unordered_map<LPCVOID, string> bufs_;
+    vector<string> includedFiles_;
 };
 
 template <typename ShaderType>
@@ -124,7 +128,11 @@ ShaderType* loadShader(ID3D11Device& device, const std::string& filename, const
     if (SUCCEEDED(D3DCompile(buf.str().c_str(), buf.str().size(), filename.c_str(), nullptr,
                              &shaderIncludeHandler, "main", target, 0, 0, &compiledShader,
                              &errorMessages))) {
-        return new ShaderType{&device, compiledShader.Get(), filename.c_str()};
+        auto shader = new ShaderType{&device, compiledShader.Get(), filename.c_str()};
+        shader->sourceFiles.push_back(filename);
+        const auto& includes = shaderIncludeHandler.includedFiles();
+        shader->sourceFiles.insert(end(shader->sourceFiles), begin(includes), end(includes));
+        return shader;
     } else {
         OutputDebugStringA(static_cast<const char*>(errorMessages->GetBufferPointer()));
         return nullptr;
@@ -139,6 +147,23 @@ PixelShaderManager::ResourceType* PixelShaderManager::createResource(const KeyTy
     return loadShader<PixelShader>(*device.Get(), key, "ps_5_0");
 }
 
+void StateManagers::reloadShaders(const vector<string>& changedFiles) {
+    const auto changed = [&changedFiles](const string& file) {
+        return find(begin(changedFiles), end(changedFiles), file) != end(changedFiles);
+    };
+    // A shader that failed to compile has no record of its includes so only its own file is known
+    const auto affected = [&changed](const string& key, const auto* shader) {
+        return shader ? any_of(begin(shader->sourceFiles), end(shader->sourceFiles), changed)
+                      : changed(key);
+    };
+    // Pipeline state objects using both a changed vertex and pixel shader are rebuilt once, after
+    // both
+    ResourceRecreateBatch batch;
+    vertexShaderManager.recreateIf(affected);
+    pixelShaderManager.recreateIf(affected);
+    batch.finish();
+}
+
 InputLayoutManager::ResourceType* InputLayoutManager::createResource(const KeyType& key) {
     ID3D11InputLayout* inputLayout = nullptr;
     if (key.inputElementDescs.empty()) return nullptr; // null InputLayout is valid
@@ -10,6 +10,8 @@ struct VertexShader {
     ID3D11VertexShaderPtr D3DVert;
     ID3DBlobPtr inputSignature;
     std::vector<unsigned char> UniformData;
+    // The shader's source file followed by every file it includes, directly or not
+    std::vector<std::string> sourceFiles;
 
     struct Uniform {
         char Name[40];
@@ -27,6 +29,8 @@ struct VertexShader {
 struct PixelShader {
     ID3D11PixelShaderPtr D3DPix;
     std::vector<unsigned char> UniformData;
+    // The shader's source file followed by every file it includes, directly or not
+    std::vector<std::string> sourceFiles;
 
     struct Uniform {
         char Name[40];
@@ -109,6 +113,16 @@ struct StateManagers {
         depthStencilStateManager.setDevice(device);
         inputLayoutManager.setDevice(device);
     }
+    // Recreate the shaders built from any of changedFiles, including those that include them
+    void reloadShaders(const std::vector<std::string>& changedFiles);
+    void collect(uint64_t completedFrame) {
+        vertexShaderManager.collect(completedFrame);
+        pixelShaderManager.collect(completedFrame);
+        blendStateManager.collect(completedFrame);
+        rasterizerStateManager.collect(completedFrame);
+        depthStencilStateManager.collect(completedFrame);
+        inputLayoutManager.collect(completedFrame);
+    }
     VertexShaderManager vertexShaderManager;
     PixelShaderManager pixelShaderManager;
     BlendStateManager blendStateManager;
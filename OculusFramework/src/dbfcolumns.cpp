@@ -0,0 +1,132 @@
+#include "dbfcolumns.h"
+
+#include "mappedfile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace std;
+
+namespace {
+
+uint32_t readLE16(const char* p) {
+    const auto b = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(b[0]) | uint32_t(b[1]) << 8;
+}
+
+uint32_t readLE32(const char* p) { return readLE16(p) | readLE16(p + 2) << 16; }
+
+bool equalsNoCase(const string& a, const char* b) {
+    const auto bLen = strlen(b);
+    return a.size() == bLen && equal(begin(a), end(a), b, [](char x, char y) {
+               return toupper(static_cast<unsigned char>(x)) ==
+                      toupper(static_cast<unsigned char>(y));
+           });
+}
+
+struct FieldDesc {
+    string name;
+    char type = 0;
+    int offset = 0;  // from start of record, including the deleted flag byte
+    int width = 0;
+};
+
+const FieldDesc& findField(const vector<FieldDesc>& fields, const string& name,
+                           const char* types) {
+    const auto it = find_if(begin(fields), end(fields),
+                            [&name](const auto& f) { return equalsNoCase(f.name, name.c_str()); });
+    if (it == end(fields)) throw runtime_error{"Missing DBF field: " + name};
+    if (!strchr(types, it->type)) throw runtime_error{"Unexpected type for DBF field: " + name};
+    return *it;
+}
+
+template <typename Names>
+int indexOfNoCase(const Names& names, const char* name) {
+    const auto it = find_if(begin(names), end(names),
+                            [name](const auto& n) { return equalsNoCase(n, name); });
+    if (it == end(names)) throw runtime_error{"DBF field was not loaded: "s + name};
+    return static_cast<int>(it - begin(names));
+}
+
+}  // namespace
+
+DbfColumns::DbfColumns(const char* filename, const vector<string>& stringFields,
+                       const vector<string>& doubleFields)
+    : stringFieldNames{stringFields}, doubleFieldNames{doubleFields} {
+    // Accept the .shp name like shapelib's DBFOpen() does
+    auto dbfName = string{filename};
+    const auto dot = dbfName.find_last_of('.');
+    const auto slash = dbfName.find_last_of("\\/");
+    if (dot != string::npos && (slash == string::npos || dot > slash)) dbfName.erase(dot);
+    const auto dbf = MappedFile{(dbfName + ".dbf").c_str()};
+    const auto data = dbf.data();
+    if (dbf.size() < 32) throw runtime_error{"Invalid DBF file: " + dbfName};
+
+    numRecords = static_cast<int>(readLE32(data + 4));
+    const auto headerLength = readLE16(data + 8);
+    const auto recordLength = readLE16(data + 10);
+    if (headerLength > dbf.size() ||
+        size_t(headerLength) + size_t(numRecords) * recordLength > dbf.size())
+        throw runtime_error{"Truncated DBF file: " + dbfName};
+
+    // 32 byte field descriptors follow the header up to a 0x0D terminator
+    auto fields = vector<FieldDesc>{};
+    auto fieldOffset = 1;
+    for (auto p = data + 32; p + 32 <= data + headerLength && *p != '\x0D'; p += 32) {
+        auto field = FieldDesc{};
+        field.name.assign(p, strnlen(p, 11));
+        field.type = p[11];
+        field.offset = fieldOffset;
+        field.width = static_cast<unsigned char>(p[16]);
+        fieldOffset += field.width;
+        fields.push_back(field);
+    }
+    if (fieldOffset > int(recordLength)) throw runtime_error{"Corrupt DBF fields: " + dbfName};
+
+    auto stringDescs = vector<FieldDesc>{};
+    for (const auto& name : stringFields) stringDescs.push_back(findField(fields, name, "C"));
+    auto doubleDescs = vector<FieldDesc>{};
+    for (const auto& name : doubleFields) doubleDescs.push_back(findField(fields, name, "NF"));
+
+    stringColumns.resize(stringDescs.size());
+    auto dictionaries = vector<unordered_map<string, uint32_t>>(stringDescs.size());
+    for (auto& column : stringColumns) column.codes.resize(numRecords);
+    doubleColumns.resize(doubleDescs.size());
+    for (auto& column : doubleColumns) column.resize(numRecords);
+
+    auto value = string{};
+    char numberChars[256];
+    auto record = data + headerLength;
+    for (int r = 0; r < numRecords; ++r, record += recordLength) {
+        for (size_t c = 0; c < stringDescs.size(); ++c) {
+            auto first = record + stringDescs[c].offset;
+            auto last = first + stringDescs[c].width;
+            while (first != last && *first == ' ') ++first;
+            while (last != first && (last[-1] == ' ' || last[-1] == '\0')) --last;
+            value.assign(first, last);
+            auto& column = stringColumns[c];
+            const auto inserted = dictionaries[c].emplace(
+                value, static_cast<uint32_t>(column.dictionary.size()));
+            if (inserted.second) column.dictionary.push_back(value);
+            column.codes[r] = inserted.first->second;
+        }
+        for (size_t c = 0; c < doubleDescs.size(); ++c) {
+            const auto width = doubleDescs[c].width;
+            memcpy(numberChars, record + doubleDescs[c].offset, width);
+            numberChars[width] = '\0';
+            doubleColumns[c][r] = strtod(numberChars, nullptr);
+        }
+    }
+}
+
+const DbfColumns::StringColumn& DbfColumns::stringColumn(const char* fieldName) const {
+    return stringColumns[indexOfNoCase(stringFieldNames, fieldName)];
+}
+
+const vector<double>& DbfColumns::doubleColumn(const char* fieldName) const {
+    return doubleColumns[indexOfNoCase(doubleFieldNames, fieldName)];
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Columnar loader for the attributes in a shapefile's .dbf. The requested fields are resolved to
+// column offsets once when the table is opened, then the memory mapped file is read in a single
+// sequential pass filling one typed column per field. String columns are dictionary encoded since
+// attributes like names and feature codes repeat heavily across a layer.
+//
+// Field names are matched case insensitively like shapelib's DBFGetFieldIndex(). String values
+// have leading and trailing spaces trimmed, also matching shapelib.
+class DbfColumns {
+public:
+    struct StringColumn {
+        std::vector<std::string> dictionary;  // distinct values
+        std::vector<std::uint32_t> codes;     // per record index into dictionary
+
+        const std::string& operator[](int record) const { return dictionary[codes[record]]; }
+    };
+
+    // Throws if the file can't be read or a requested field is missing or has the wrong type
+    DbfColumns(const char* filename, const std::vector<std::string>& stringFields,
+               const std::vector<std::string>& doubleFields);
+
+    int size() const { return numRecords; }
+
+    const StringColumn& stringColumn(const char* fieldName) const;
+    const std::vector<double>& doubleColumn(const char* fieldName) const;
+
+private:
+    std::vector<std::string> stringFieldNames;
+    std::vector<StringColumn> stringColumns;
+    std::vector<std::string> doubleFieldNames;
+    std::vector<std::vector<double>> doubleColumns;
+    int numRecords = 0;
+};
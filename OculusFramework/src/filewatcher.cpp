@@ -0,0 +1,120 @@
+#include "filewatcher.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+
+struct FileWatcher::Request {
+    OVERLAPPED overlapped = {};
+    // FILE_NOTIFY_INFORMATION records, which must be DWORD aligned
+    DWORD buffer[16 * 1024];
+};
+
+FileWatcher::FileWatcher(const char* directory) : request{make_unique<Request>()} {
+    const auto handle =
+        CreateFileA(directory, FILE_LIST_DIRECTORY,
+                    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                    FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        throw runtime_error{"Failed to open directory to watch: "s + directory};
+    directoryHandle = handle;
+    request->overlapped.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    if (!request->overlapped.hEvent) {
+        CloseHandle(directoryHandle);
+        throw runtime_error{"Failed to create event to watch directory: "s + directory};
+    }
+    issueRead();
+}
+
+FileWatcher::~FileWatcher() {
+    // Wait for the cancelled read so the kernel is done with the buffer before it is freed
+    CancelIo(directoryHandle);
+    auto bytes = DWORD{};
+    GetOverlappedResult(directoryHandle, &request->overlapped, &bytes, TRUE);
+    CloseHandle(request->overlapped.hEvent);
+    CloseHandle(directoryHandle);
+}
+
+void FileWatcher::issueRead() {
+    ResetEvent(request->overlapped.hEvent);
+    // Editors often save by writing a temporary file and renaming it over the original so renames
+    // count as changes too
+    if (!ReadDirectoryChangesW(directoryHandle, request->buffer, sizeof(request->buffer), FALSE,
+                               FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME,
+                               nullptr, &request->overlapped, nullptr))
+        throw runtime_error{"Failed to read directory changes"};
+}
+
+vector<string> FileWatcher::changedFiles() {
+    auto res = vector<string>{};
+    auto bytes = DWORD{};
+    // Fails with ERROR_IO_INCOMPLETE once there are no more completed reads. A read that completes
+    // with no bytes overflowed and its changes are lost.
+    while (GetOverlappedResult(directoryHandle, &request->overlapped, &bytes, FALSE)) {
+        auto record = reinterpret_cast<const char*>(request->buffer);
+        for (auto remaining = bytes; remaining > 0;) {
+            const auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(record);
+            if (info->Action == FILE_ACTION_MODIFIED || info->Action == FILE_ACTION_ADDED ||
+                info->Action == FILE_ACTION_RENAMED_NEW_NAME) {
+                const auto nameLength = static_cast<int>(info->FileNameLength / sizeof(WCHAR));
+                const auto size = WideCharToMultiByte(CP_UTF8, 0, info->FileName, nameLength,
+                                                      nullptr, 0, nullptr, nullptr);
+                auto name = string(size, '\0');
+                WideCharToMultiByte(CP_UTF8, 0, info->FileName, nameLength, &name[0], size,
+                                    nullptr, nullptr);
+                res.push_back(move(name));
+            }
+            if (!info->NextEntryOffset) break;
+            record += info->NextEntryOffset;
+            remaining -= info->NextEntryOffset;
+        }
+        issueRead();
+    }
+    sort(begin(res), end(res));
+    res.erase(unique(begin(res), end(res)), end(res));
+    return res;
+}
+
+#else
+
+FileWatcher::FileWatcher(const char* directory) {
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) throw runtime_error{"Failed to create inotify instance"};
+    // Editors often save by writing a temporary file and renaming it over the original so renames
+    // count as changes too
+    if (inotify_add_watch(inotifyFd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(inotifyFd);
+        throw runtime_error{"Failed to watch directory: "s + directory};
+    }
+}
+
+FileWatcher::~FileWatcher() { close(inotifyFd); }
+
+vector<string> FileWatcher::changedFiles() {
+    auto res = vector<string>{};
+    alignas(inotify_event) char buffer[16 * 1024];
+    for (;;) {
+        const auto bytes = read(inotifyFd, buffer, sizeof(buffer));
+        if (bytes <= 0) break;
+        for (auto record = buffer; record < buffer + bytes;) {
+            const auto event = reinterpret_cast<const inotify_event*>(record);
+            if (event->len) res.emplace_back(event->name);
+            record += sizeof(inotify_event) + event->len;
+        }
+    }
+    sort(begin(res), end(res));
+    res.erase(unique(begin(res), end(res)), end(res));
+    return res;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Reports files in a directory that have been written to, for hot reloading. Uses
+// ReadDirectoryChangesW on Windows and inotify on Linux. Only the directory itself is watched, not
+// its subdirectories.
+class FileWatcher {
+public:
+    explicit FileWatcher(const char* directory);
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+    ~FileWatcher();
+
+    // Names relative to the directory of the files changed since the last call, each listed once.
+    // Never blocks.
+    std::vector<std::string> changedFiles();
+
+private:
+#ifdef _WIN32
+    struct Request;
+    void issueRead();
+
+    void* directoryHandle = nullptr;
+    std::unique_ptr<Request> request;
+#else
+    int inotifyFd = -1;
+#endif
+};
@@ -0,0 +1,93 @@
+#include "mappedfile.h"
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+MappedFile::MappedFile(const char* filename) {
+#ifdef _WIN32
+    const auto file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw runtime_error{"Failed to open file for mapping: "s + filename};
+    fileHandle = file;
+    auto sizeBytes = LARGE_INTEGER{};
+    if (!GetFileSizeEx(file, &sizeBytes)) {
+        close();
+        throw runtime_error{"Failed to get size of file: "s + filename};
+    }
+    fileSize = static_cast<size_t>(sizeBytes.QuadPart);
+    if (fileSize == 0) return;  // Can't map an empty file
+    mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mappingHandle) {
+        close();
+        throw runtime_error{"Failed to create file mapping: "s + filename};
+    }
+    view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        close();
+        throw runtime_error{"Failed to map view of file: "s + filename};
+    }
+#else
+    const auto fd = open(filename, O_RDONLY);
+    if (fd < 0) throw runtime_error{"Failed to open file for mapping: "s + filename};
+    struct stat st = {};
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw runtime_error{"Failed to get size of file: "s + filename};
+    }
+    fileSize = static_cast<size_t>(st.st_size);
+    if (fileSize > 0) {
+        const auto mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            throw runtime_error{"Failed to map file: "s + filename};
+        }
+        madvise(mapping, fileSize, MADV_SEQUENTIAL);
+        view = mapping;
+    }
+    ::close(fd);  // The mapping keeps its own reference to the file
+#endif
+}
+
+MappedFile::MappedFile(MappedFile&& x) { *this = move(x); }
+
+MappedFile::~MappedFile() { close(); }
+
+MappedFile& MappedFile::operator=(MappedFile&& x) {
+    if (this != &x) {
+        close();
+        swap(view, x.view);
+        swap(fileSize, x.fileSize);
+#ifdef _WIN32
+        swap(fileHandle, x.fileHandle);
+        swap(mappingHandle, x.mappingHandle);
+#endif
+    }
+    return *this;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (view) UnmapViewOfFile(view);
+    if (mappingHandle) CloseHandle(mappingHandle);
+    if (fileHandle) CloseHandle(fileHandle);
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+#else
+    if (view) munmap(const_cast<void*>(view), fileSize);
+#endif
+    view = nullptr;
+    fileSize = 0;
+}
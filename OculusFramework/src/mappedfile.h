@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+
+// Read only memory mapping of a whole file. The mapping lives as long as the MappedFile so views
+// into data() must not outlive it.
+class MappedFile {
+public:
+    MappedFile() = default;
+    explicit MappedFile(const char* filename);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile(MappedFile&& x);
+    ~MappedFile();
+
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile& operator=(MappedFile&& x);
+
+    const char* data() const { return static_cast<const char*>(view); }
+    std::size_t size() const { return fileSize; }
+    explicit operator bool() const { return view != nullptr; }
+
+private:
+    void close();
+
+    const void* view = nullptr;
+    std::size_t fileSize = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
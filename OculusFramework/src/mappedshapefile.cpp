@@ -0,0 +1,228 @@
+#include "mappedshapefile.h"
+
+#include "shapefil.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MAPPEDSHAPEFILE_SSE2 1
+#endif
+
+using namespace std;
+
+using namespace mathlib;
+
+namespace {
+
+// Shapefiles mix big endian (file structure) and little endian (record contents) fields and
+// nothing in them is guaranteed to be aligned so all reads go through memcpy. These assume a
+// little endian host.
+int32_t readLE32(const char* p) {
+    auto x = int32_t{};
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+int32_t readBE32(const char* p) {
+    const auto b = reinterpret_cast<const unsigned char*>(p);
+    return int32_t(uint32_t(b[0]) << 24 | uint32_t(b[1]) << 16 | uint32_t(b[2]) << 8 |
+                   uint32_t(b[3]));
+}
+
+double readLEDouble(const char* p) {
+    auto x = double{};
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+// (lat, long) corners from an xmin, ymin, xmax, ymax box of doubles
+pair<Vec2f, Vec2f> latLongBox(const char* box) {
+    return {Vec2f{float(readLEDouble(box + 8)), float(readLEDouble(box))},
+            Vec2f{float(readLEDouble(box + 24)), float(readLEDouble(box + 16))}};
+}
+
+const auto headerSize = size_t{100};
+const auto recordHeaderSize = size_t{8};
+
+bool overlaps(const pair<Vec2f, Vec2f>& a, const Vec2f& minCorner, const Vec2f& maxCorner) {
+    return a.first.x() <= maxCorner.x() && a.first.y() <= maxCorner.y() &&
+           a.second.x() >= minCorner.x() && a.second.y() >= minCorner.y();
+}
+
+string replaceExtension(const char* filename, const char* extension) {
+    auto res = string{filename};
+    const auto dot = res.find_last_of('.');
+    const auto slash = res.find_last_of("\\/");
+    if (dot != string::npos && (slash == string::npos || dot > slash)) res.erase(dot);
+    return res + extension;
+}
+
+}  // namespace
+
+MappedShapeFile::MappedShapeFile(const char* filename)
+    : shp{replaceExtension(filename, ".shp").c_str()},
+      shx{replaceExtension(filename, ".shx").c_str()} {
+    if (shp.size() < headerSize || shx.size() < headerSize || readBE32(shp.data()) != 9994 ||
+        readBE32(shx.data()) != 9994)
+        throw runtime_error{"Invalid shapefile: "s + filename};
+    type = readLE32(shp.data() + 32);
+    bounds = latLongBox(shp.data() + 36);
+    // .shx is the 100 byte header followed by a big endian (offset, length) pair per record
+    numRecords = static_cast<int>((shx.size() - headerSize) / 8);
+
+    const auto qix = replaceExtension(filename, ".qix");
+    if (const auto fp = fopen(qix.c_str(), "rb")) {
+        fclose(fp);
+        qixFilename = qix;
+    }
+}
+
+vector<int> MappedShapeFile::recordsInLatLongRect(const Vec2f& minLatLong,
+                                                  const Vec2f& maxLatLong) const {
+    auto res = vector<int>{};
+    if (!overlaps(bounds, minLatLong, maxLatLong)) return res;
+
+    // The quadtree only gives candidates from the nodes overlapping the query so the record
+    // bounding boxes are still tested below
+    auto candidates = vector<int>{};
+    auto haveCandidates = false;
+    if (!qixFilename.empty()) {
+        const auto tree = unique_ptr<SHPDiskTreeInfo, void (*)(SHPTreeDiskHandle)>{
+            SHPOpenDiskTree(qixFilename.c_str(), nullptr), SHPCloseDiskTree};
+        if (tree) {
+            double searchMin[4] = {minLatLong.y(), minLatLong.x(), 0.0, 0.0};
+            double searchMax[4] = {maxLatLong.y(), maxLatLong.x(), 0.0, 0.0};
+            auto count = 0;
+            const auto ids = unique_ptr<int, void (*)(void*)>{
+                SHPSearchDiskTreeEx(tree.get(), searchMin, searchMax, &count), free};
+            // A null result with no error just means an empty search
+            candidates.assign(ids.get(), ids.get() + (ids ? count : 0));
+            haveCandidates = true;
+        }
+    }
+    if (!haveCandidates) {
+        candidates.resize(numRecords);
+        for (int i = 0; i < numRecords; ++i) candidates[i] = i;
+    }
+
+    for (const auto i : candidates) {
+        if (i < 0 || i >= numRecords) continue;
+        const auto r = record(i);
+        if (r.numPoints() > 0 && overlaps(r.latLongBounds(), minLatLong, maxLatLong))
+            res.push_back(i);
+    }
+    return res;
+}
+
+MappedShapeFile::Record MappedShapeFile::record(int i) const {
+    if (i < 0 || i >= numRecords) throw out_of_range{"Shapefile record index out of range."};
+
+    // Offsets and lengths in the .shx are in 16 bit words
+    const auto indexEntry = shx.data() + headerSize + i * 8;
+    const auto offset = size_t(readBE32(indexEntry)) * 2;
+    const auto length = size_t(readBE32(indexEntry + 4)) * 2;
+    if (offset + recordHeaderSize + length > shp.size() || length < 4)
+        throw runtime_error{"Shapefile record extends past end of file."};
+
+    const auto content = shp.data() + offset + recordHeaderSize;
+    auto res = Record{};
+    res.id = i;
+    res.type = readLE32(content);
+    auto minLength = size_t{4};
+    switch (res.type) {
+        case SHPT_NULL:
+            break;
+        case SHPT_POINT:
+        case SHPT_POINTZ:
+        case SHPT_POINTM:
+            res.pointCount = 1;
+            res.points = content + 4;
+            minLength = 20;
+            break;
+        case SHPT_MULTIPOINT:
+        case SHPT_MULTIPOINTZ:
+        case SHPT_MULTIPOINTM:
+            res.box = content + 4;
+            res.pointCount = readLE32(content + 36);
+            res.points = content + 40;
+            minLength = 40 + size_t(res.pointCount) * 16;
+            break;
+        case SHPT_ARC:
+        case SHPT_ARCZ:
+        case SHPT_ARCM:
+        case SHPT_POLYGON:
+        case SHPT_POLYGONZ:
+        case SHPT_POLYGONM:
+        case SHPT_MULTIPATCH:
+            res.box = content + 4;
+            res.partCount = readLE32(content + 36);
+            res.pointCount = readLE32(content + 40);
+            res.parts = content + 44;
+            res.points = res.parts + size_t(res.partCount) * 4;
+            if (res.type == SHPT_MULTIPATCH) {
+                res.partTypes = res.points;
+                res.points += size_t(res.partCount) * 4;
+            }
+            minLength = size_t(res.points - content) + size_t(res.pointCount) * 16;
+            break;
+        default:
+            throw runtime_error{"Unsupported shapefile record type " + to_string(res.type)};
+    }
+    if (res.partCount < 0 || res.pointCount < 0 || minLength > length)
+        throw runtime_error{"Corrupt shapefile record " + to_string(i)};
+    return res;
+}
+
+int MappedShapeFile::Record::partStart(int i) const {
+    assert(i >= 0 && i < partCount);
+    return readLE32(parts + i * 4);
+}
+
+int MappedShapeFile::Record::partType(int i) const {
+    assert(i >= 0 && i < partCount);
+    return partTypes ? readLE32(partTypes + i * 4) : SHPP_RING;
+}
+
+pair<Vec2f, Vec2f> MappedShapeFile::Record::latLongBounds() const {
+    if (box) return latLongBox(box);
+    const auto p = pointCount ? latLong(0) : Vec2f{0.0f};
+    return {p, p};
+}
+
+Vec2f MappedShapeFile::Record::latLong(int i) const {
+    assert(i >= 0 && i < pointCount);
+    const auto p = points + i * 16;
+    return {float(readLEDouble(p + 8)), float(readLEDouble(p))};
+}
+
+void MappedShapeFile::Record::decodeLatLongs(gsl::array_view<Vec2f> latLongs) const {
+    static_assert(sizeof(Vec2f) == 2 * sizeof(float), "Vec2f must be two packed floats");
+    if (latLongs.size() < size_t(pointCount))
+        throw invalid_argument{"Output too small for shapefile record."};
+    auto out = reinterpret_cast<float*>(latLongs.data());
+    auto i = 0;
+#ifdef MAPPEDSHAPEFILE_SSE2
+    // Two points per iteration: narrow each (x, y) double pair to floats, pack both points into
+    // one register and swap to (y, x) order.
+    for (; i + 2 <= pointCount; i += 2) {
+        const auto p = reinterpret_cast<const double*>(points + i * 16);
+        const auto p0 = _mm_cvtpd_ps(_mm_loadu_pd(p));
+        const auto p1 = _mm_cvtpd_ps(_mm_loadu_pd(p + 2));
+        const auto xyxy = _mm_movelh_ps(p0, p1);
+        _mm_storeu_ps(out + i * 2, _mm_shuffle_ps(xyxy, xyxy, _MM_SHUFFLE(2, 3, 0, 1)));
+    }
+#endif
+    for (; i < pointCount; ++i) {
+        const auto p = latLong(i);
+        out[i * 2] = p.x();
+        out[i * 2 + 1] = p.y();
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "mappedfile.h"
+
+#include "vector.h"
+
+#pragma warning(push)
+#pragma warning(disable : 4245)
+#include <array_view.h>
+#pragma warning(pop)
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// Zero copy reader for the geometry in an ESRI shapefile. The .shp and .shx files are memory
+// mapped and each record is exposed as a lightweight view directly over the mapped point data so
+// opening a layer does no per shape allocation. Coordinates are decoded on demand, callers that
+// want the points of a whole record should use decodeLatLongs() which converts them in bulk.
+//
+// Points are returned as (latitude, longitude), i.e. (y, x) in shapefile terms, to match the rest
+// of the terrain code. Attributes in the .dbf are not handled here.
+class MappedShapeFile {
+public:
+    // View of a single record, only valid while the owning MappedShapeFile is alive.
+    class Record {
+    public:
+        int shapeId() const { return id; }
+        int shapeType() const { return type; }
+        int numParts() const { return partCount; }
+        int numPoints() const { return pointCount; }
+        // Index of the first point of part i
+        int partStart(int i) const;
+        // SHPP_* type of part i, always SHPP_RING for anything other than multipatches
+        int partType(int i) const;
+        // Bounding box of the record as (lat, long) min and max corners
+        std::pair<mathlib::Vec2f, mathlib::Vec2f> latLongBounds() const;
+
+        mathlib::Vec2f latLong(int i) const;
+        // Decode all numPoints() points into latLongs which must be at least that big
+        void decodeLatLongs(gsl::array_view<mathlib::Vec2f> latLongs) const;
+
+    private:
+        friend class MappedShapeFile;
+
+        const char* parts = nullptr;      // int32 part starts
+        const char* partTypes = nullptr;  // int32 part types, multipatch only
+        const char* points = nullptr;     // interleaved x, y doubles
+        const char* box = nullptr;        // xmin, ymin, xmax, ymax doubles, null for points
+        int id = 0;
+        int type = 0;
+        int partCount = 0;
+        int pointCount = 0;
+    };
+
+    // Forward iterator over records in file order so a layer can be streamed with range-for
+    class iterator {
+    public:
+        iterator(const MappedShapeFile* f, int i) : file{f}, index{i} {}
+        Record operator*() const { return file->record(index); }
+        iterator& operator++() {
+            ++index;
+            return *this;
+        }
+        bool operator==(const iterator& x) const { return index == x.index; }
+        bool operator!=(const iterator& x) const { return index != x.index; }
+
+    private:
+        const MappedShapeFile* file;
+        int index;
+    };
+
+    // filename may name the .shp or omit the extension, the .shx is found next to it
+    explicit MappedShapeFile(const char* filename);
+
+    int size() const { return numRecords; }
+    int shapeType() const { return type; }
+    std::pair<mathlib::Vec2f, mathlib::Vec2f> latLongBounds() const { return bounds; }
+
+    Record record(int i) const;
+    // Ids of the records whose bounding boxes overlap the (lat, long) rectangle, ascending. If a
+    // .qix quadtree index (from shapelib's shptreedump/shptree) sits next to the .shp it is used
+    // so records far outside the rectangle are never touched.
+    std::vector<int> recordsInLatLongRect(const mathlib::Vec2f& minLatLong,
+                                          const mathlib::Vec2f& maxLatLong) const;
+    iterator begin() const { return {this, 0}; }
+    iterator end() const { return {this, numRecords}; }
+
+private:
+    MappedFile shp;
+    MappedFile shx;
+    std::string qixFilename;  // empty if there is no .qix
+    std::pair<mathlib::Vec2f, mathlib::Vec2f> bounds;
+    int numRecords = 0;
+    int type = 0;
+};
@@ -0,0 +1,200 @@
+#include "mipchain.h"
+
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MIPCHAIN_SSE2 1
+#endif
+
+using namespace std;
+
+namespace {
+
+const auto rowsPerTask = 16;
+
+// sRGB to linear for every 8 bit value
+const array<float, 256>& srgbToLinear() {
+    static const auto table = [] {
+        auto res = array<float, 256>{};
+        for (int i = 0; i < 256; ++i) {
+            const auto c = i / 255.0f;
+            res[i] = c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return res;
+    }();
+    return table;
+}
+
+// Linear in [0, 1] quantized to 4096 steps to 8 bit sRGB
+const array<unsigned char, 4096>& linearToSrgb() {
+    static const auto table = [] {
+        auto res = array<unsigned char, 4096>{};
+        for (int i = 0; i < 4096; ++i) {
+            const auto l = i / 4095.0f;
+            const auto c = l <= 0.0031308f ? l * 12.92f : 1.055f * pow(l, 1.0f / 2.4f) - 0.055f;
+            res[i] = static_cast<unsigned char>(c * 255.0f + 0.5f);
+        }
+        return res;
+    }();
+    return table;
+}
+
+unsigned char& channel(Rgba& p, int c) { return (&p.r)[c]; }
+unsigned char channel(const Rgba& p, int c) { return (&p.r)[c]; }
+
+// Downsample dst pixels [x0, x1) of a row from source rows a and b of srcWidth pixels. The
+// source column past an odd width's end is its last one.
+void downsampleRow(const Rgba* a, const Rgba* b, int srcWidth, Rgba* dst, int x0, int x1,
+                   const MipChainOptions& options) {
+    const auto& toLinear = srgbToLinear();
+    const auto& toSrgb = linearToSrgb();
+    auto x = x0;
+#ifdef MIPCHAIN_SSE2
+    // Two destination pixels from four source pixels of each row at a time, box filtered in 16 bit
+    // lanes and max filtered bytewise then selected per channel. sRGB averaging is left to the
+    // scalar loop.
+    if (!options.srgb) {
+        auto maxBytes = 0u;
+        for (int c = 0; c < 4; ++c)
+            if (options.filters[c] == MipFilter::max) maxBytes |= 0xffu << (8 * c);
+        const auto maxMask = _mm_set1_epi32(static_cast<int>(maxBytes));
+        const auto zero = _mm_setzero_si128();
+        const auto two = _mm_set1_epi16(2);
+        for (; x + 1 < x1 && 2 * x + 3 < srcWidth; x += 2) {
+            const auto ra = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 2 * x));
+            const auto rb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 2 * x));
+            const auto lo = _mm_add_epi16(_mm_unpacklo_epi8(ra, zero), _mm_unpacklo_epi8(rb, zero));
+            const auto hi = _mm_add_epi16(_mm_unpackhi_epi8(ra, zero), _mm_unpackhi_epi8(rb, zero));
+            const auto sums = _mm_unpacklo_epi64(_mm_add_epi16(lo, _mm_srli_si128(lo, 8)),
+                                                 _mm_add_epi16(hi, _mm_srli_si128(hi, 8)));
+            const auto average =
+                _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(sums, two), 2), zero);
+            const auto rowMax = _mm_max_epu8(ra, rb);
+            const auto pairMax = _mm_max_epu8(rowMax, _mm_srli_si128(rowMax, 4));
+            const auto maxes = _mm_shuffle_epi32(pairMax, _MM_SHUFFLE(3, 1, 2, 0));
+            const auto res = _mm_or_si128(_mm_and_si128(maxMask, maxes),
+                                          _mm_andnot_si128(maxMask, average));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x), res);
+        }
+    }
+#endif
+    for (; x < x1; ++x) {
+        const auto sx0 = 2 * x;
+        const auto sx1 = min(2 * x + 1, srcWidth - 1);
+        const Rgba* const src[] = {a + sx0, a + sx1, b + sx0, b + sx1};
+        for (int c = 0; c < 4; ++c) {
+            if (options.filters[c] == MipFilter::max) {
+                channel(dst[x], c) = max({channel(*src[0], c), channel(*src[1], c),
+                                          channel(*src[2], c), channel(*src[3], c)});
+            } else if (options.srgb && c < 3 && options.filters[c] == MipFilter::average) {
+                const auto l = toLinear[channel(*src[0], c)] + toLinear[channel(*src[1], c)] +
+                               toLinear[channel(*src[2], c)] + toLinear[channel(*src[3], c)];
+                channel(dst[x], c) = toSrgb[static_cast<int>(l * (4095.0f / 4.0f) + 0.5f)];
+            } else {
+                channel(dst[x], c) = static_cast<unsigned char>(
+                    (channel(*src[0], c) + channel(*src[1], c) + channel(*src[2], c) +
+                     channel(*src[3], c) + 2) >> 2);
+            }
+        }
+    }
+}
+
+// Scale that makes the fraction of values in histogram at or over half intensity coverage
+float coverageScale(const array<int, 256>& histogram, float coverage) {
+    auto total = 0;
+    for (const auto count : histogram) total += count;
+    const auto target = coverage * total;
+    if (target <= 0.0f) return 1.0f;
+    // Lowest threshold with at least the target count at or above it
+    auto above = 0;
+    auto threshold = 255;
+    for (; threshold > 1; --threshold) {
+        above += histogram[threshold];
+        if (above >= target) break;
+    }
+    return 128.0f / threshold;
+}
+
+array<int, 256> channelHistogram(const RgbaImage& image, int c) {
+    auto res = array<int, 256>{};
+    for (int y = 0; y < image.height(); ++y)
+        for (int x = 0; x < image.width(); ++x) ++res[channel(image.row(y)[x], c)];
+    return res;
+}
+
+}  // namespace
+
+MipChain::MipChain(RgbaImage image, const MipChainOptions& options, int maxLevels)
+    : mipOptions{options} {
+    auto fullLevels = 1;
+    while ((max(image.width(), image.height()) >> fullLevels) > 0) ++fullLevels;
+    const auto count = maxLevels > 0 ? min(maxLevels, fullLevels) : fullLevels;
+    const auto width = image.width();
+    const auto height = image.height();
+    levels.push_back(move(image));
+    for (int i = 1; i < count; ++i)
+        levels.emplace_back(max(width >> i, 1), max(height >> i, 1));
+    coverageScales.assign(count, array<float, 4>{{1.0f, 1.0f, 1.0f, 1.0f}});
+    update({0, 0, width, height});
+}
+
+void MipChain::update(const PixelRect& dirty) {
+    const auto full = dirty.x0 <= 0 && dirty.y0 <= 0 && dirty.x1 >= levels[0].width() &&
+                      dirty.y1 >= levels[0].height();
+    auto coverage = array<float, 4>{};
+    if (full) {
+        const auto numPixels = float(levels[0].width()) * levels[0].height();
+        for (int c = 0; c < 4; ++c) {
+            if (mipOptions.filters[c] != MipFilter::preserveCoverage) continue;
+            const auto histogram = channelHistogram(levels[0], c);
+            auto above = 0;
+            for (int i = 128; i < 256; ++i) above += histogram[i];
+            coverage[c] = above / numPixels;
+        }
+    }
+
+    auto rect = dirty;
+    for (int level = 1; level < numLevels(); ++level) {
+        // Pixels whose 2x2 source footprint overlaps the previous level's rect
+        rect = {max(rect.x0 / 2, 0), max(rect.y0 / 2, 0),
+                min((rect.x1 + 1) / 2, levels[level].width()),
+                min((rect.y1 + 1) / 2, levels[level].height())};
+        if (rect.x0 >= rect.x1 || rect.y0 >= rect.y1) break;
+        downsample(level, rect);
+        for (int c = 0; c < 4; ++c) {
+            if (mipOptions.filters[c] != MipFilter::preserveCoverage) continue;
+            if (full)
+                coverageScales[level][c] =
+                    coverageScale(channelHistogram(levels[level], c), coverage[c]);
+        }
+        rescaleCoverage(level, rect);
+    }
+}
+
+void MipChain::downsample(int level, const PixelRect& rect) {
+    const auto& src = levels[level - 1];
+    auto& dst = levels[level];
+    ThreadPool::global().parallelFor(rect.y1 - rect.y0, rowsPerTask, [&](int begin, int end) {
+        for (auto y = rect.y0 + begin; y < rect.y0 + end; ++y) {
+            downsampleRow(src.row(2 * y), src.row(min(2 * y + 1, src.height() - 1)), src.width(),
+                          dst.row(y), rect.x0, rect.x1, mipOptions);
+        }
+    });
+}
+
+void MipChain::rescaleCoverage(int level, const PixelRect& rect) {
+    for (int c = 0; c < 4; ++c) {
+        const auto scale = coverageScales[level][c];
+        if (mipOptions.filters[c] != MipFilter::preserveCoverage || scale == 1.0f) continue;
+        for (int y = rect.y0; y < rect.y1; ++y) {
+            for (int x = rect.x0; x < rect.x1; ++x) {
+                auto& v = channel(levels[level].row(y)[x], c);
+                v = static_cast<unsigned char>(min(v * scale + 0.5f, 255.0f));
+            }
+        }
+    }
+}
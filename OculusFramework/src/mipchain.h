@@ -0,0 +1,60 @@
+#pragma once
+
+#include "rasterizer.h"
+
+#include <array>
+#include <vector>
+
+// CPU generation of mip chains for RGBA8 images, used for overlay tiles and procedural textures
+// so thin features can be kept visible in the lower levels, which the GPU's GenerateMips() box
+// filter fades out.
+
+// Downsampling filter for one channel
+enum class MipFilter {
+    // 2x2 box filter
+    average,
+    // 2x2 max, keeps thin features at full intensity in every level
+    max,
+    // 2x2 box filter with each level rescaled so the fraction of texels over half intensity
+    // matches level 0, keeps thin features about as visible as in level 0 without thickening them
+    preserveCoverage
+};
+
+struct MipChainOptions {
+    std::array<MipFilter, 4> filters = {
+        {MipFilter::average, MipFilter::average, MipFilter::average, MipFilter::average}};
+    // Whether r, g and b are sRGB encoded and so should be averaged in linear space. Only applies
+    // to channels using MipFilter::average.
+    bool srgb = false;
+};
+
+// Pixel rectangle [x0, x1) x [y0, y1)
+struct PixelRect {
+    int x0, y0, x1, y1;
+};
+
+// An image and its mip levels. Levels are built a row band at a time on the global thread pool,
+// two output pixels at a time with SSE2 where available.
+class MipChain {
+public:
+    // maxLevels of 0 builds the full chain down to 1x1
+    MipChain(RgbaImage image, const MipChainOptions& options, int maxLevels = 0);
+
+    int numLevels() const { return static_cast<int>(levels.size()); }
+    const RgbaImage& level(int i) const { return levels[i]; }
+    // Level 0 for editing, call update() with the changed area afterwards
+    RgbaImage& base() { return levels[0]; }
+
+    // Rebuild the parts of every level that depend on dirty in level 0. Coverage preserving
+    // channels reuse the scale chosen by the last full rebuild so only dirty moves.
+    void update(const PixelRect& dirty);
+
+private:
+    void downsample(int level, const PixelRect& rect);
+    void rescaleCoverage(int level, const PixelRect& rect);
+
+    MipChainOptions mipOptions;
+    std::vector<RgbaImage> levels;
+    // Per level and channel value scale for MipFilter::preserveCoverage
+    std::vector<std::array<float, 4>> coverageScales;
+};
@@ -0,0 +1,108 @@
+#include "overlaybake.h"
+
+#include "simplify.h"
+#include "util.h"
+
+#include <algorithm>
+
+using namespace std;
+
+using namespace mathlib;
+using namespace util;
+
+// Whether points, mapped to image pixels, come within margin pixels of a width x height image
+static bool nearImage(gsl::array_view<const Vec2f> points, const Vec2f& origin, float outputScale,
+                      float margin, int width, int height) {
+    if (points.size() == 0) return false;
+    auto minX = points[0].x(), maxX = minX, minY = points[0].y(), maxY = minY;
+    for (const auto& p : points) {
+        minX = min(minX, p.x());
+        maxX = max(maxX, p.x());
+        minY = min(minY, p.y());
+        maxY = max(maxY, p.y());
+    }
+    return (maxX - origin.x()) * outputScale > -margin &&
+           (minX - origin.x()) * outputScale < width + margin &&
+           (maxY - origin.y()) * outputScale > -margin &&
+           (minY - origin.y()) * outputScale < height + margin;
+}
+
+// Arcs coming within margin pixels of a width x height image as open contours of a path in image
+// pixels, skipping points that are insignificant at this output resolution
+static Path arcPath(const VectorLayer& arcs, int width, int height, float margin,
+                    float outputScale, const Vec2f& origin) {
+    const auto tolerance = simplificationTolerance(outputScale);
+    auto path = Path{};
+    for (const auto c : arcs) {
+        const auto pixPositions = c.pixPositions();
+        if (!nearImage(pixPositions, origin, outputScale, margin, width, height)) continue;
+        const auto significance = c.significance();
+        auto first = true;
+        for (int i = 0; i < c.numPoints(); ++i) {
+            if (significance[i] <= tolerance) continue;
+            const auto p = (pixPositions[i] - origin) * outputScale;
+            first ? path.moveTo(p) : path.lineTo(p);
+            first = false;
+        }
+    }
+    return path;
+}
+
+int bakeArcLayer(const VectorLayer& arcs, RgbaImage& image, Rgba color, float width,
+                 float outputScale, const Vec2f& origin) {
+    const auto path = arcPath(arcs, image.width(), image.height(), width, outputScale, origin);
+    return strokePolylines(path, width, LineJoin::miter, color, image);
+}
+
+vector<float> bakeArcDistanceField(const VectorLayer& arcs, int width, int height,
+                                   float maxDistance, float outputScale, const Vec2f& origin) {
+    const auto path = arcPath(arcs, width, height, maxDistance, outputScale, origin);
+    return polylineDistanceField(path, width, height, maxDistance);
+}
+
+// Twice the signed area of a closed ring
+static float ringArea(gsl::array_view<const Vec2f> ring) {
+    auto res = 0.0f;
+    for (size_t i = 0; i < ring.size(); ++i) {
+        const auto& a = ring[i];
+        const auto& b = ring[i + 1 < ring.size() ? i + 1 : 0];
+        res += a.x() * b.y() - b.x() * a.y();
+    }
+    return res;
+}
+
+void bakePolygonLayer(const VectorLayer& polygons, RgbaImage& image, Rgba outlineColor,
+                      Rgba fillColor, float outlineWidth, float outputScale, const Vec2f& origin) {
+    // Skip points that are insignificant at this output resolution, ring starts are always
+    // significant. Outer rings and holes wind in opposite directions, clipping keeps that, so
+    // filling nonzero cuts out holes while shapes that overlap, such as the same feature split
+    // differently by two extracts, fill as their union. A simplified ring keeps the winding of the
+    // full ring in case simplifying flipped it.
+    const auto tolerance = simplificationTolerance(outputScale);
+    auto path = Path{};
+    auto ring = vector<Vec2f>{};
+    for (const auto p : polygons) {
+        const auto pixPositions = p.pixPositions();
+        if (!nearImage(pixPositions, origin, outputScale, outlineWidth + 1.0f, image.width(),
+                       image.height()))
+            continue;
+        const auto significance = p.significance();
+        for (int i = 0; i < p.numParts(); ++i) {
+            ring.clear();
+            ring.push_back((pixPositions[p.partBegin(i)] - origin) * outputScale);
+            for (int j = p.partBegin(i) + 1; j < p.partEnd(i); ++j) {
+                if (significance[j] <= tolerance) continue;
+                ring.push_back((pixPositions[j] - origin) * outputScale);
+            }
+            const auto fullArea =
+                ringArea(pixPositions.sub(p.partBegin(i), p.partEnd(i) - p.partBegin(i)));
+            const auto area = ringArea(const_array_view(ring));
+            if (area == 0.0f) continue;
+            if ((area > 0.0f) != (fullArea > 0.0f)) reverse(begin(ring), end(ring));
+            path.addContour(const_array_view(ring));
+        }
+    }
+    // The outline follows the edge of the filled union so seams where an extract boundary or map
+    // sheet edge split a shape aren't outlined
+    fillAndOutlinePath(path, FillRule::nonZero, fillColor, outlineColor, outlineWidth, image);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "rasterizer.h"
+#include "vectorlayer.h"
+
+#include "vector.h"
+
+#include <vector>
+
+// Baking of vector layers into the overlay images sampled by the terrain shader. These only use
+// the CPU rasterizer so run headless. pixPositions p maps to image pixel (p - origin) *
+// outputScale, outputScale also selects the simplification level. Shapes entirely outside the
+// image are skipped so baking a small region of a large layer is cheap.
+
+// Fill polygons with fillColor, their overlaps as a union, then outline the filled region with
+// outlineColor
+void bakePolygonLayer(const VectorLayer& polygons, RgbaImage& image, Rgba outlineColor,
+                      Rgba fillColor, float outlineWidth, float outputScale,
+                      const mathlib::Vec2f& origin);
+
+// Stroke each arc with color using miter joins. Returns the number of segments drawn.
+int bakeArcLayer(const VectorLayer& arcs, RgbaImage& image, Rgba color, float width,
+                 float outputScale, const mathlib::Vec2f& origin);
+
+// Distance in image pixels from each pixel of a width x height field to the nearest arc, clamped
+// to maxDistance. Rows top to bottom.
+std::vector<float> bakeArcDistanceField(const VectorLayer& arcs, int width, int height,
+                                        float maxDistance, float outputScale,
+                                        const mathlib::Vec2f& origin);
@@ -0,0 +1,65 @@
+#include "overlaymask.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+using namespace mathlib;
+using namespace util;
+
+OverlayMaskImage packOverlayMask(const array<const RgbaImage*, overlayMaskLayers / 4>& layers) {
+    const auto width = layers[0]->width();
+    const auto height = layers[0]->height();
+    for (const auto image : layers)
+        if (image->width() != width || image->height() != height)
+            throw runtime_error{"Overlay mask layer images differ in size"};
+
+    // 8 bit coverage to the nearest overlayMaskBits value
+    auto quantize = array<uint16_t, 256>{};
+    for (int i = 0; i < 256; ++i)
+        quantize[i] = uint16_t((i * overlayMaskMaxValue + 127) / 255);
+
+    auto res = OverlayMaskImage{width, height};
+    for (int y = 0; y < height; ++y) {
+        auto dst = res.row(y);
+        for (size_t image = 0; image < layers.size(); ++image) {
+            const auto src = layers[image]->row(y);
+            const auto shift = int(image) * 4 * overlayMaskBits;
+            for (int x = 0; x < width; ++x) {
+                const auto& p = src[x];
+                const auto packed = quantize[p.r] | quantize[p.g] << overlayMaskBits |
+                                    quantize[p.b] << 2 * overlayMaskBits |
+                                    quantize[p.a] << 3 * overlayMaskBits;
+                dst[x] = uint16_t(dst[x] | packed << shift);
+            }
+        }
+    }
+    return res;
+}
+
+array<float, overlayMaskLayers> sampleOverlayMask(const OverlayMaskImage& image,
+                                                  const Vec2f& texel) {
+    const auto x = texel.x() - 0.5f;
+    const auto y = texel.y() - 0.5f;
+    const auto fx = x - floor(x);
+    const auto fy = y - floor(y);
+    const auto clampX = [&image](int i) { return min(max(i, 0), image.width() - 1); };
+    const auto clampY = [&image](int i) { return min(max(i, 0), image.height() - 1); };
+    const auto x0 = clampX(to<int>(floor(x)));
+    const auto x1 = clampX(to<int>(floor(x)) + 1);
+    const auto y0 = clampY(to<int>(floor(y)));
+    const auto y1 = clampY(to<int>(floor(y)) + 1);
+    const uint16_t texels[] = {image.row(y0)[x0], image.row(y0)[x1], image.row(y1)[x0],
+                               image.row(y1)[x1]};
+    const float weights[] = {(1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy};
+
+    auto res = array<float, overlayMaskLayers>{};
+    for (int layer = 0; layer < overlayMaskLayers; ++layer)
+        for (int i = 0; i < 4; ++i)
+            res[layer] += weights[i] * overlayMaskCoverage(texels[i], layer);
+    return res;
+}
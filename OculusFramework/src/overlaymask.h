@@ -0,0 +1,54 @@
+#pragma once
+
+#include "rasterizer.h"
+
+#include "vector.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Compact storage for the terrain overlay. The overlay is a stack of coverage masks, one per
+// vector layer, so rather than a colour channel each layer gets overlayMaskBits of a
+// DXGI_FORMAT_R16_UINT texel. terrainps.hlsl decodes and filters these itself, sampleOverlayMask()
+// below is the CPU equivalent.
+
+static const int overlayMaskLayers = 8;
+static const int overlayMaskBits = 2;
+static const int overlayMaskMaxValue = (1 << overlayMaskBits) - 1;
+
+// Layers are baked at 8 bits into the channels of RGBA images, layer i in channel i % 4 of image
+// i / 4, and quantized when packed
+using OverlayLayerImages = std::array<RgbaImage, overlayMaskLayers / 4>;
+
+// Image of packed overlay mask texels, rows top to bottom with no padding
+class OverlayMaskImage {
+public:
+    OverlayMaskImage() = default;
+    OverlayMaskImage(int w, int h) : imageWidth{w}, imageHeight{h}, texels(size_t(w) * h) {}
+
+    int width() const { return imageWidth; }
+    int height() const { return imageHeight; }
+    int rowPitch() const { return imageWidth * static_cast<int>(sizeof(uint16_t)); }
+    uint16_t* row(int y) { return texels.data() + size_t(y) * imageWidth; }
+    const uint16_t* row(int y) const { return texels.data() + size_t(y) * imageWidth; }
+    const uint16_t* data() const { return texels.data(); }
+
+private:
+    int imageWidth = 0;
+    int imageHeight = 0;
+    std::vector<uint16_t> texels;
+};
+
+// Quantize and pack layers, which must all be the same size
+OverlayMaskImage packOverlayMask(const std::array<const RgbaImage*, overlayMaskLayers / 4>& layers);
+
+// Coverage in [0, 1] of layer in a packed texel
+inline float overlayMaskCoverage(uint16_t texel, int layer) {
+    return float((texel >> (layer * overlayMaskBits)) & overlayMaskMaxValue) / overlayMaskMaxValue;
+}
+
+// Bilinearly filtered coverage of every layer at texel, where texel centers are at + 0.5 and
+// edge texels are clamped, as the shader samples one mip level
+std::array<float, overlayMaskLayers> sampleOverlayMask(const OverlayMaskImage& image,
+                                                       const mathlib::Vec2f& texel);
@@ -0,0 +1,609 @@
+#include "rasterizer.h"
+
+#include "mathfuncs.h"
+#include "threadpool.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RASTERIZER_SSE2 1
+#endif
+
+using namespace std;
+
+using namespace mathlib;
+using namespace util;
+
+namespace {
+
+const auto bandHeight = 16;
+const auto subScanlines = 16;
+
+struct Edge {
+    float x0, y0;  // top end
+    float y1;
+    float dxdy;
+    int winding;
+};
+
+struct Crossing {
+    float x;
+    int winding;
+};
+
+vector<Edge> buildEdges(const Path& path) {
+    auto res = vector<Edge>{};
+    for (int i = 0; i < path.numContours(); ++i) {
+        const auto contour = path.contour(i);
+        const auto n = to<int>(contour.size());
+        for (int j = 0; j < n; ++j) {
+            auto a = contour[j];
+            auto b = contour[j + 1 < n ? j + 1 : 0];
+            if (a.y() == b.y()) continue;  // horizontal edges never cross a sub-scanline
+            auto winding = 1;
+            if (a.y() > b.y()) {
+                swap(a, b);
+                winding = -1;
+            }
+            res.push_back({a.x(), a.y(), b.y(), (b.x() - a.x()) / (b.y() - a.y()), winding});
+        }
+    }
+    return res;
+}
+
+// Source over blend of color into dst with the given coverage
+void blend(Rgba& dst, Rgba color, float coverage) {
+    const auto a = min(coverage, 1.0f) * (color.a / 255.0f);
+    if (a <= 0.0f) return;
+    const auto mix = [a](unsigned char src, unsigned char d) {
+        return static_cast<unsigned char>(src * a + d * (1.0f - a) + 0.5f);
+    };
+    dst = {mix(color.r, dst.r), mix(color.g, dst.g), mix(color.b, dst.b), mix(255, dst.a)};
+}
+
+// Per row coverage accumulation. Partial pixel coverage at span ends goes in cover and fully
+// covered runs are added to delta as a difference array, so a span costs O(1) however long.
+class RowCoverage {
+public:
+    explicit RowCoverage(int w) : width{w}, cover(w + 1, 0.0f), delta(w + 1, 0.0f) {}
+
+    void addSpan(float xa, float xb, float weight) {
+        xa = mathlib::clamp(xa, 0.0f, float(width));
+        xb = mathlib::clamp(xb, 0.0f, float(width));
+        if (xb <= xa) return;
+        const auto ia = static_cast<int>(xa);
+        const auto ib = static_cast<int>(xb);
+        minX = min(minX, ia);
+        maxX = max(maxX, ib);
+        if (ia == ib) {
+            cover[ia] += (xb - xa) * weight;
+            return;
+        }
+        cover[ia] += (ia + 1 - xa) * weight;
+        delta[ia + 1] += weight;
+        delta[ib] -= weight;
+        cover[ib] += (xb - ib) * weight;
+    }
+
+    // Blend color into row by the accumulated coverage and reset for the next row
+    void composite(Rgba color, Rgba* row) {
+        auto full = 0.0f;
+        for (int x = minX; x <= min(maxX, width - 1); ++x) {
+            full += delta[x];
+            blend(row[x], color, cover[x] + full);
+        }
+        if (minX <= maxX) {
+            fill(begin(cover) + minX, begin(cover) + maxX + 1, 0.0f);
+            fill(begin(delta) + minX, begin(delta) + maxX + 1, 0.0f);
+        }
+        minX = width;
+        maxX = -1;
+    }
+
+private:
+    int width;
+    vector<float> cover;
+    vector<float> delta;
+    int minX = width;
+    int maxX = -1;
+};
+
+const auto tileSize = 32;
+// Miter length limit as a multiple of the line width, longer miters are beveled as in SVG
+const auto miterLimit = 4.0f;
+
+struct StrokeSegment {
+    Vec2f a, d;  // start and direction scaled by length
+    float invLengthSq;
+};
+
+// Convex join polygon described by its edges as origins and outward unit normals
+struct JoinPolygon {
+    Vec2f origins[4];
+    Vec2f normals[4];
+    int numEdges;
+};
+
+JoinPolygon makeJoinPolygon(const Vec2f* points, int numPoints) {
+    auto area = 0.0f;
+    for (int i = 0; i < numPoints; ++i) {
+        const auto& p = points[i];
+        const auto& q = points[(i + 1) % numPoints];
+        area += p.x() * q.y() - q.x() * p.y();
+    }
+    const auto orientation = area < 0.0f ? -1.0f : 1.0f;
+    auto res = JoinPolygon{};
+    for (int i = 0; i < numPoints; ++i) {
+        const auto e = points[(i + 1) % numPoints] - points[i];
+        const auto length = sqrt(e.x() * e.x() + e.y() * e.y());
+        if (length == 0.0f) continue;
+        res.origins[res.numEdges] = points[i];
+        res.normals[res.numEdges] = Vec2f{e.y(), -e.x()} * (orientation / length);
+        ++res.numEdges;
+    }
+    return res;
+}
+
+// Region a miter join adds outside the two segments' rectangles at p, beveled past miterLimit.
+// u and v are the unit directions into and out of p. Returns false for collinear segments
+// which need no join.
+bool miterJoin(const Vec2f& p, const Vec2f& u, const Vec2f& v, float halfWidth,
+               JoinPolygon& join) {
+    const auto cross = u.x() * v.y() - u.y() * v.x();
+    if (abs(cross) < 1e-6f) return false;
+    // Outer side normals, to the right of the path when it turns left
+    const auto side = cross > 0.0f ? -1.0f : 1.0f;
+    const auto n0 = Vec2f{-u.y(), u.x()} * side;
+    const auto n1 = Vec2f{-v.y(), v.x()} * side;
+    const auto corner0 = p + n0 * halfWidth;
+    const auto corner1 = p + n1 * halfWidth;
+    const auto bisector = n0 + n1;
+    const auto bisectorLength = sqrt(bisector.x() * bisector.x() + bisector.y() * bisector.y());
+    // Distance to the miter tip in half widths is 1 / cos of half the angle between the normals
+    const auto cosHalfAngle = bisectorLength * 0.5f;
+    if (cosHalfAngle * 2.0f * miterLimit < 1.0f) {
+        const Vec2f bevel[] = {p, corner0, corner1};
+        join = makeJoinPolygon(bevel, 3);
+    } else {
+        const auto tip = p + bisector * (halfWidth / (bisectorLength * cosHalfAngle));
+        const Vec2f miter[] = {p, corner0, tip, corner1};
+        join = makeJoinPolygon(miter, 4);
+    }
+    return true;
+}
+
+// Distance from the pixel centers of tile rows [y0, y1) and columns [x0, x1) to a segment,
+// merged into distances by min. Columns are processed four at a time from x0 rounded down to a
+// multiple of 4.
+void segmentDistance(const StrokeSegment& s, int tileX, int tileY, int x0, int x1, int y0, int y1,
+                     float* distances) {
+    x0 &= ~3;
+#ifdef RASTERIZER_SSE2
+    const auto ax = _mm_set1_ps(s.a.x());
+    const auto ay = _mm_set1_ps(s.a.y());
+    const auto dx = _mm_set1_ps(s.d.x());
+    const auto dy = _mm_set1_ps(s.d.y());
+    const auto invLengthSq = _mm_set1_ps(s.invLengthSq);
+    const auto zero = _mm_setzero_ps();
+    const auto one = _mm_set1_ps(1.0f);
+    const auto offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    for (int y = y0; y < y1; ++y) {
+        const auto apy = _mm_sub_ps(_mm_set1_ps(tileY + y + 0.5f), ay);
+        auto row = distances + y * tileSize;
+        for (int x = x0; x < x1; x += 4) {
+            const auto apx =
+                _mm_sub_ps(_mm_add_ps(_mm_set1_ps(float(tileX + x)), offsets), ax);
+            auto t = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(apx, dx), _mm_mul_ps(apy, dy)), invLengthSq);
+            t = _mm_min_ps(_mm_max_ps(t, zero), one);
+            const auto ex = _mm_sub_ps(apx, _mm_mul_ps(dx, t));
+            const auto ey = _mm_sub_ps(apy, _mm_mul_ps(dy, t));
+            const auto dist = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)));
+            _mm_store_ps(row + x, _mm_min_ps(_mm_load_ps(row + x), dist));
+        }
+    }
+#else
+    for (int y = y0; y < y1; ++y) {
+        const auto apy = tileY + y + 0.5f - s.a.y();
+        auto row = distances + y * tileSize;
+        for (int x = x0; x < x1; ++x) {
+            const auto apx = tileX + x + 0.5f - s.a.x();
+            const auto t = mathlib::clamp((apx * s.d.x() + apy * s.d.y()) * s.invLengthSq, 0.0f,
+                                          1.0f);
+            const auto ex = apx - s.d.x() * t;
+            const auto ey = apy - s.d.y() * t;
+            row[x] = min(row[x], sqrt(ex * ex + ey * ey));
+        }
+    }
+#endif
+}
+
+void joinCoverage(const JoinPolygon& join, int tileX, int tileY, int x0, int x1, int y0, int y1,
+                  float* coverage) {
+    for (int y = y0; y < y1; ++y) {
+        auto row = coverage + y * tileSize;
+        for (int x = x0; x < x1; ++x) {
+            const auto p = Vec2f{tileX + x + 0.5f, tileY + y + 0.5f};
+            // Signed distance to a convex polygon, exact inside and near the edges
+            auto dist = -numeric_limits<float>::max();
+            for (int i = 0; i < join.numEdges; ++i) {
+                const auto op = p - join.origins[i];
+                dist = max(dist, op.x() * join.normals[i].x() + op.y() * join.normals[i].y());
+            }
+            row[x] = max(row[x], mathlib::clamp(0.5f - dist, 0.0f, 1.0f));
+        }
+    }
+}
+
+vector<StrokeSegment> polylineSegments(const Path& path) {
+    auto res = vector<StrokeSegment>{};
+    for (int i = 0; i < path.numContours(); ++i) {
+        const auto contour = path.contour(i);
+        for (int j = 0; j + 1 < to<int>(contour.size()); ++j) {
+            const auto d = contour[j + 1] - contour[j];
+            const auto lengthSq = d.x() * d.x() + d.y() * d.y();
+            if (lengthSq > 0.0f) res.push_back({contour[j], d, 1.0f / lengthSq});
+        }
+    }
+    return res;
+}
+
+pair<Vec2f, Vec2f> segmentBounds(const StrokeSegment& s, float reach) {
+    const auto b = s.a + s.d;
+    return {Vec2f{min(s.a.x(), b.x()) - reach, min(s.a.y(), b.y()) - reach},
+            Vec2f{max(s.a.x(), b.x()) + reach, max(s.a.y(), b.y()) + reach}};
+}
+
+// Primitives binned into the tiles of a width x height image their bounds overlap. Tile i's
+// primitives are primitives[starts[i], starts[i + 1]).
+struct TileBins {
+    int tilesX, tilesY;
+    vector<int> starts;
+    vector<int> primitives;
+
+    int numTiles() const { return tilesX * tilesY; }
+};
+
+template <typename Bounds>
+TileBins binIntoTiles(int numPrimitives, int width, int height, Bounds bounds) {
+    auto res = TileBins{(width + tileSize - 1) / tileSize, (height + tileSize - 1) / tileSize};
+    const auto tileCoord = [](float x, int numTiles) {
+        return mathlib::clamp(static_cast<int>(floor(x / tileSize)), 0, numTiles - 1);
+    };
+    // Calls f(tile) for each tile primitive i overlaps
+    const auto forTiles = [&](int i, auto f) {
+        const auto b = bounds(i);
+        if (b.second.x() < 0.0f || b.second.y() < 0.0f || b.first.x() >= width ||
+            b.first.y() >= height)
+            return;
+        const auto tx0 = tileCoord(b.first.x(), res.tilesX);
+        const auto tx1 = tileCoord(b.second.x(), res.tilesX);
+        for (auto ty = tileCoord(b.first.y(), res.tilesY);
+             ty <= tileCoord(b.second.y(), res.tilesY); ++ty)
+            for (auto tx = tx0; tx <= tx1; ++tx) f(ty * res.tilesX + tx);
+    };
+    res.starts.assign(res.numTiles() + 1, 0);
+    for (int i = 0; i < numPrimitives; ++i)
+        forTiles(i, [&res](int tile) { ++res.starts[tile + 1]; });
+    for (int i = 0; i < res.numTiles(); ++i) res.starts[i + 1] += res.starts[i];
+    res.primitives.resize(res.starts.back());
+    auto next = vector<int>(begin(res.starts), end(res.starts) - 1);
+    for (int i = 0; i < numPrimitives; ++i)
+        forTiles(i, [&res, &next, i](int tile) { res.primitives[next[tile]++] = i; });
+    return res;
+}
+
+// Pixel range [x0, x1) x [y0, y1) of bounds b within the tile at (tileX, tileY)
+struct TileRect {
+    int x0, x1, y0, y1;
+};
+
+TileRect tileRect(const pair<Vec2f, Vec2f>& b, int tileX, int tileY) {
+    const auto coord = [](float x, int offset) {
+        return mathlib::clamp(static_cast<int>(floor(x)) + offset, 0, tileSize);
+    };
+    return {coord(b.first.x(), -tileX), coord(b.second.x(), 1 - tileX),
+            coord(b.first.y(), -tileY), coord(b.second.y(), 1 - tileY)};
+}
+
+// Distance transform input for pixels far from any site
+const auto farDistance = 1e20f;
+
+// Squared distance from each element of a row of n with stride to the nearest site along the row,
+// where f is 0 at sites and farDistance elsewhere, in place. Lower envelope of parabolas from
+// Felzenszwalb and Huttenlocher, "Distance Transforms of Sampled Functions". v and z are scratch.
+void squaredDistanceRow(float* f, int n, int stride, vector<float>& row, vector<int>& v,
+                        vector<double>& z) {
+    row.resize(n);
+    v.resize(n);
+    z.resize(n + 1);
+    for (int q = 0; q < n; ++q) row[q] = f[q * stride];
+    auto k = 0;
+    v[0] = 0;
+    z[0] = -numeric_limits<double>::infinity();
+    z[1] = numeric_limits<double>::infinity();
+    // Where the parabola from q overtakes the one from the envelope's i-th site
+    const auto intersection = [&row, &v](int q, int i) {
+        const auto p = v[i];
+        return ((row[q] + double(q) * q) - (row[p] + double(p) * p)) / (2.0 * (q - p));
+    };
+    for (int q = 1; q < n; ++q) {
+        auto s = intersection(q, k);
+        while (s <= z[k]) s = intersection(q, --k);
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = numeric_limits<double>::infinity();
+    }
+    k = 0;
+    for (int q = 0; q < n; ++q) {
+        while (z[k + 1] < q) ++k;
+        const auto d = float(q - v[k]);
+        f[q * stride] = d * d + row[v[k]];
+    }
+}
+
+// Squared distance transform of a width x height grid in place, see squaredDistanceRow()
+void squaredDistanceTransform(vector<float>& grid, int width, int height) {
+    auto row = vector<float>{};
+    auto v = vector<int>{};
+    auto z = vector<double>{};
+    for (int x = 0; x < width; ++x) squaredDistanceRow(&grid[x], height, width, row, v, z);
+    for (int y = 0; y < height; ++y)
+        squaredDistanceRow(&grid[size_t(y) * width], width, 1, row, v, z);
+}
+
+}  // namespace
+
+void Path::moveTo(const Vec2f& p) {
+    contourEnds.push_back(to<int>(points.size()));
+    lineTo(p);
+}
+
+void Path::lineTo(const Vec2f& p) {
+    assert(!contourEnds.empty());
+    points.push_back(p);
+    ++contourEnds.back();
+}
+
+void Path::addContour(gsl::array_view<const Vec2f> contour) {
+    if (contour.size() == 0) return;
+    contourEnds.push_back(to<int>(points.size()));
+    points.insert(end(points), begin(contour), end(contour));
+    contourEnds.back() = to<int>(points.size());
+}
+
+gsl::array_view<const Vec2f> Path::contour(int i) const {
+    const auto first = i > 0 ? contourEnds[i - 1] : 0;
+    return {points.data() + first, contourEnds[i] - first};
+}
+
+void fillPath(const Path& path, FillRule fillRule, Rgba color, RgbaImage& image) {
+    const auto width = image.width();
+    const auto height = image.height();
+    if (width <= 0 || height <= 0) return;
+    const auto edges = buildEdges(path);
+
+    // Bin the edges into the bands they overlap, sorted by their top within each band
+    const auto numBands = (height + bandHeight - 1) / bandHeight;
+    const auto bandRange = [height](const Edge& e) {
+        const auto first = static_cast<int>(max(e.y0, 0.0f)) / bandHeight;
+        const auto last = static_cast<int>(min(e.y1, float(height)) - 1e-3f) / bandHeight;
+        return make_pair(first, last);
+    };
+    auto bandStarts = vector<int>(numBands + 1, 0);
+    for (const auto& e : edges) {
+        if (e.y1 <= 0.0f || e.y0 >= float(height)) continue;
+        const auto range = bandRange(e);
+        for (auto band = range.first; band <= range.second; ++band) ++bandStarts[band + 1];
+    }
+    for (int i = 0; i < numBands; ++i) bandStarts[i + 1] += bandStarts[i];
+    auto bandEdges = vector<int>(bandStarts.back());
+    {
+        auto next = vector<int>(begin(bandStarts), end(bandStarts) - 1);
+        for (int i = 0; i < to<int>(edges.size()); ++i) {
+            const auto& e = edges[i];
+            if (e.y1 <= 0.0f || e.y0 >= float(height)) continue;
+            const auto range = bandRange(e);
+            for (auto band = range.first; band <= range.second; ++band)
+                bandEdges[next[band]++] = i;
+        }
+    }
+
+    ThreadPool::global().parallelFor(numBands, 1, [&](int firstBand, int lastBand) {
+        auto coverage = RowCoverage{width};
+        auto active = vector<int>{};
+        auto crossings = vector<Crossing>{};
+        for (int band = firstBand; band < lastBand; ++band) {
+            const auto first = begin(bandEdges) + bandStarts[band];
+            const auto last = begin(bandEdges) + bandStarts[band + 1];
+            if (first == last) continue;
+            sort(first, last, [&edges](int a, int b) { return edges[a].y0 < edges[b].y0; });
+            auto nextEdge = first;
+            active.clear();
+            const auto bandEnd = min((band + 1) * bandHeight, height);
+            for (int y = band * bandHeight; y < bandEnd; ++y) {
+                for (int s = 0; s < subScanlines; ++s) {
+                    const auto sy = y + (s + 0.5f) / subScanlines;
+                    for (; nextEdge != last && edges[*nextEdge].y0 <= sy; ++nextEdge)
+                        active.push_back(*nextEdge);
+                    active.erase(remove_if(begin(active), end(active),
+                                           [&edges, sy](int e) { return edges[e].y1 <= sy; }),
+                                 end(active));
+                    if (active.empty()) continue;
+                    crossings.clear();
+                    for (const auto i : active) {
+                        const auto& e = edges[i];
+                        crossings.push_back({e.x0 + (sy - e.y0) * e.dxdy, e.winding});
+                    }
+                    sort(begin(crossings), end(crossings),
+                         [](const auto& a, const auto& b) { return a.x < b.x; });
+                    auto winding = 0;
+                    for (size_t i = 0; i + 1 < crossings.size(); ++i) {
+                        winding += crossings[i].winding;
+                        const auto inside =
+                            fillRule == FillRule::nonZero ? winding != 0 : (winding & 1) != 0;
+                        if (inside)
+                            coverage.addSpan(crossings[i].x, crossings[i + 1].x,
+                                             1.0f / subScanlines);
+                    }
+                }
+                coverage.composite(color, image.row(y));
+            }
+        }
+    });
+}
+
+void fillAndOutlinePath(const Path& path, FillRule fillRule, Rgba fillColor, Rgba outlineColor,
+                        float width, RgbaImage& image) {
+    // Fill coverage over the image and a margin the outline can reach into the image from
+    const auto halfWidth = 0.5f * width;
+    const auto margin = static_cast<int>(ceil(halfWidth)) + 1;
+    const auto offset = Vec2f{float(margin), float(margin)};
+    auto shifted = Path{};
+    auto contour = vector<Vec2f>{};
+    for (int i = 0; i < path.numContours(); ++i) {
+        contour.clear();
+        for (const auto& p : path.contour(i)) contour.push_back(p + offset);
+        shifted.addContour(const_array_view(contour));
+    }
+    auto coverage = RgbaImage{image.width() + 2 * margin, image.height() + 2 * margin};
+    fillPath(shifted, fillRule, Rgba{255, 255, 255, 255}, coverage);
+
+    // Distance from each pixel center to the nearest pixel center on the other side of the
+    // filled region's edge, which is about half a pixel further than the edge itself
+    const auto w = coverage.width();
+    const auto h = coverage.height();
+    auto toOutside = vector<float>(size_t(w) * h);
+    auto toInside = vector<float>(size_t(w) * h);
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            const auto inside = coverage.row(y)[x].a >= 128;
+            toOutside[size_t(y) * w + x] = inside ? farDistance : 0.0f;
+            toInside[size_t(y) * w + x] = inside ? 0.0f : farDistance;
+        }
+    }
+    squaredDistanceTransform(toOutside, w, h);
+    squaredDistanceTransform(toInside, w, h);
+
+    for (int y = 0; y < image.height(); ++y) {
+        auto row = image.row(y);
+        const auto coverageRow = coverage.row(y + margin) + margin;
+        for (int x = 0; x < image.width(); ++x) {
+            const auto i = size_t(y + margin) * w + x + margin;
+            blend(row[x], fillColor, coverageRow[x].a / 255.0f);
+            const auto edgeDistance = sqrt(max(toOutside[i], toInside[i])) - 0.5f;
+            blend(row[x], outlineColor,
+                  mathlib::clamp(halfWidth + 0.5f - edgeDistance, 0.0f, 1.0f));
+        }
+    }
+}
+
+int strokePolylines(const Path& path, float width, LineJoin join, Rgba color, RgbaImage& image) {
+    const auto halfWidth = 0.5f * width;
+    // Coverage falls from 1 to 0 over the pixel straddling the line edge
+    const auto reach = halfWidth + 0.5f;
+
+    const auto segments = polylineSegments(path);
+    auto joins = vector<JoinPolygon>{};
+    if (join == LineJoin::miter) {
+        for (int i = 0; i < path.numContours(); ++i) {
+            const auto contour = path.contour(i);
+            auto previousDirection = Vec2f{0.0f, 0.0f};
+            auto havePrevious = false;
+            for (int j = 0; j + 1 < to<int>(contour.size()); ++j) {
+                const auto d = contour[j + 1] - contour[j];
+                const auto lengthSq = d.x() * d.x() + d.y() * d.y();
+                if (lengthSq == 0.0f) continue;
+                const auto direction = d * (1.0f / sqrt(lengthSq));
+                auto miter = JoinPolygon{};
+                if (havePrevious &&
+                    miterJoin(contour[j], previousDirection, direction, halfWidth, miter))
+                    joins.push_back(miter);
+                previousDirection = direction;
+                havePrevious = true;
+            }
+        }
+    }
+
+    // Segments first then joins
+    const auto numSegments = to<int>(segments.size());
+    const auto bounds = [&](int i) {
+        if (i < numSegments) return segmentBounds(segments[i], reach);
+        const auto& j = joins[i - numSegments];
+        auto res = make_pair(j.origins[0], j.origins[0]);
+        for (int k = 1; k < j.numEdges; ++k) {
+            const auto& p = j.origins[k];
+            res.first = {min(res.first.x(), p.x()), min(res.first.y(), p.y())};
+            res.second = {max(res.second.x(), p.x()), max(res.second.y(), p.y())};
+        }
+        return make_pair(res.first - Vec2f{0.5f, 0.5f}, res.second + Vec2f{0.5f, 0.5f});
+    };
+    const auto bins = binIntoTiles(to<int>(segments.size() + joins.size()), image.width(),
+                                   image.height(), bounds);
+
+    ThreadPool::global().parallelFor(bins.numTiles(), 4, [&](int firstTile, int lastTile) {
+        alignas(16) float coverage[tileSize * tileSize];
+        for (int tile = firstTile; tile < lastTile; ++tile) {
+            if (bins.starts[tile] == bins.starts[tile + 1]) continue;
+            const auto tileX = tile % bins.tilesX * tileSize;
+            const auto tileY = tile / bins.tilesX * tileSize;
+            // Nearest segment distance first, coverage only depends on that
+            fill(begin(coverage), end(coverage), reach);
+            for (auto k = bins.starts[tile]; k < bins.starts[tile + 1]; ++k) {
+                const auto i = bins.primitives[k];
+                if (i >= numSegments) continue;
+                const auto r = tileRect(bounds(i), tileX, tileY);
+                segmentDistance(segments[i], tileX, tileY, r.x0, r.x1, r.y0, r.y1, coverage);
+            }
+            for (auto& c : coverage) c = mathlib::clamp(reach - c, 0.0f, 1.0f);
+            for (auto k = bins.starts[tile]; k < bins.starts[tile + 1]; ++k) {
+                const auto i = bins.primitives[k];
+                if (i < numSegments) continue;
+                const auto r = tileRect(bounds(i), tileX, tileY);
+                joinCoverage(joins[i - numSegments], tileX, tileY, r.x0, r.x1, r.y0, r.y1,
+                             coverage);
+            }
+            const auto w = min(tileSize, image.width() - tileX);
+            const auto h = min(tileSize, image.height() - tileY);
+            for (int y = 0; y < h; ++y) {
+                auto row = image.row(tileY + y) + tileX;
+                for (int x = 0; x < w; ++x) blend(row[x], color, coverage[y * tileSize + x]);
+            }
+        }
+    });
+    return numSegments;
+}
+
+vector<float> polylineDistanceField(const Path& path, int width, int height, float maxDistance) {
+    const auto segments = polylineSegments(path);
+    const auto bins = binIntoTiles(to<int>(segments.size()), width, height, [&](int i) {
+        return segmentBounds(segments[i], maxDistance);
+    });
+    auto res = vector<float>(size_t(width) * height, maxDistance);
+    ThreadPool::global().parallelFor(bins.numTiles(), 4, [&](int firstTile, int lastTile) {
+        alignas(16) float distances[tileSize * tileSize];
+        for (int tile = firstTile; tile < lastTile; ++tile) {
+            if (bins.starts[tile] == bins.starts[tile + 1]) continue;
+            const auto tileX = tile % bins.tilesX * tileSize;
+            const auto tileY = tile / bins.tilesX * tileSize;
+            fill(begin(distances), end(distances), maxDistance);
+            for (auto k = bins.starts[tile]; k < bins.starts[tile + 1]; ++k) {
+                const auto& s = segments[bins.primitives[k]];
+                const auto r = tileRect(segmentBounds(s, maxDistance), tileX, tileY);
+                segmentDistance(s, tileX, tileY, r.x0, r.x1, r.y0, r.y1, distances);
+            }
+            const auto w = min(tileSize, width - tileX);
+            const auto h = min(tileSize, height - tileY);
+            for (int y = 0; y < h; ++y) {
+                copy_n(distances + y * tileSize, w,
+                       begin(res) + (size_t(tileY + y) * width + tileX));
+            }
+        }
+    });
+    return res;
+}
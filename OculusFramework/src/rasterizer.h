@@ -0,0 +1,84 @@
+#pragma once
+
+#include "vector.h"
+
+#pragma warning(push)
+#pragma warning(disable : 4245)
+#include <array_view.h>
+#pragma warning(pop)
+
+#include <vector>
+
+// Portable CPU rasterization of 2D vector paths into RGBA8 images, used to bake the vector
+// layer overlay textures without a GPU device. Pixel (x, y) covers [x, x + 1) x [y, y + 1).
+
+struct Rgba {
+    unsigned char r, g, b, a;
+};
+
+// Image in the DXGI_FORMAT_R8G8B8A8 memory layout, rows top to bottom with no padding
+class RgbaImage {
+public:
+    RgbaImage() = default;
+    RgbaImage(int w, int h) : imageWidth{w}, imageHeight{h}, pixels(size_t(w) * h, Rgba{}) {}
+
+    int width() const { return imageWidth; }
+    int height() const { return imageHeight; }
+    int rowPitch() const { return imageWidth * static_cast<int>(sizeof(Rgba)); }
+    Rgba* row(int y) { return pixels.data() + size_t(y) * imageWidth; }
+    const Rgba* row(int y) const { return pixels.data() + size_t(y) * imageWidth; }
+    const Rgba* data() const { return pixels.data(); }
+
+private:
+    int imageWidth = 0;
+    int imageHeight = 0;
+    std::vector<Rgba> pixels;
+};
+
+// A set of closed contours
+class Path {
+public:
+    void moveTo(const mathlib::Vec2f& p);
+    void lineTo(const mathlib::Vec2f& p);
+    void addContour(gsl::array_view<const mathlib::Vec2f> contour);
+
+    int numContours() const { return static_cast<int>(contourEnds.size()); }
+    // Points of contour i, the closing edge back to its first point is implicit
+    gsl::array_view<const mathlib::Vec2f> contour(int i) const;
+    bool empty() const { return points.empty(); }
+
+private:
+    std::vector<mathlib::Vec2f> points;
+    std::vector<int> contourEnds;
+};
+
+enum class FillRule { evenOdd, nonZero };
+
+// Fill path into image with color, source over blended. Edges go through an active edge table
+// per 16 pixel high band with bands rasterized in parallel on the global thread pool. Coverage
+// is exact along each sub-scanline and sampled at 16 sub-scanlines per pixel row.
+void fillPath(const Path& path, FillRule fillRule, Rgba color, RgbaImage& image);
+
+// Fill path into image with fillColor, then outline the filled region with outlineColor in a band
+// of width centered on its edge, both source over blended. The outline follows the edge of the
+// region rather than the contours, so contours that overlap or abut, such as pieces of a shape
+// split along a seam, get no outline where they meet. Distances to the edge come from exact
+// distance transforms of the fill coverage thresholded at half, so are accurate to about half a
+// pixel. Parts of path within width of the image count towards the region.
+void fillAndOutlinePath(const Path& path, FillRule fillRule, Rgba fillColor, Rgba outlineColor,
+                        float width, RgbaImage& image);
+
+enum class LineJoin { round, miter };
+
+// Stroke each contour of path as an open polyline of width with round caps. Coverage comes from
+// each pixel's distance to the segments, evaluated four pixels at a time with SSE2 where
+// available, over 32x32 pixel tiles the segments are binned into first. Tiles are rasterized in
+// parallel on the global thread pool. Returns the number of segments drawn.
+int strokePolylines(const Path& path, float width, LineJoin join, Rgba color, RgbaImage& image);
+
+// Distance from each pixel center of a width x height image to the nearest segment of the
+// contours of path taken as open polylines, clamped to maxDistance. Distances are exact, computed
+// as in strokePolylines() over tiles with segments binned into those within maxDistance. Rows
+// top to bottom.
+std::vector<float> polylineDistanceField(const Path& path, int width, int height,
+                                         float maxDistance);
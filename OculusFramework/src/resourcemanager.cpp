@@ -1,2 +1,138 @@
 #include "resourcemanager.h"
 
+#include <functional>
+#include <unordered_set>
+
+using namespace std;
+
+namespace {
+
+mutex graphMutex;
+
+// Nodes used by each resource creation in progress on this thread, innermost last
+thread_local vector<vector<ResourceNode*>> recordings;
+
+// ResourceRecreateBatches open on this thread and the roots whose dependents they defer
+thread_local int batchDepth = 0;
+thread_local vector<ResourceNode*> deferredRoots;
+
+void removeNode(vector<ResourceNode*>& nodes, ResourceNode* node) {
+    nodes.erase(remove(begin(nodes), end(nodes), node), end(nodes));
+}
+
+}  // namespace
+
+ResourceNode::~ResourceNode() {
+    lock_guard<mutex> lock{graphMutex};
+    assert(!pins && "A resource must not be freed while a recreate will visit it");
+    unlinkDependencies();
+    for (auto dependent : dependents) removeNode(dependent->dependencies, this);
+}
+
+void ResourceNode::recordUse() {
+    if (!recordings.empty()) recordings.back().push_back(this);
+}
+
+void ResourceNode::setDependencies(const vector<ResourceNode*>& nodes) {
+    lock_guard<mutex> lock{graphMutex};
+    unlinkDependencies();
+    dependencies = nodes;
+    for (auto dependency : dependencies) dependency->dependents.push_back(this);
+}
+
+bool ResourceNode::tryRemove() {
+    lock_guard<mutex> lock{graphMutex};
+    if (pins) return false;
+    unlinkDependencies();
+    for (auto dependent : dependents) removeNode(dependent->dependencies, this);
+    dependents.clear();
+    return true;
+}
+
+void ResourceNode::unlinkDependencies() {
+    for (auto dependency : dependencies) removeNode(dependency->dependents, this);
+    dependencies.clear();
+}
+
+void ResourceNode::recreateDependents(const vector<ResourceNode*>& roots) {
+    if (batchDepth > 0) {
+        // Pinned until the batch finishes, the caller's references to them end before that
+        pin(roots);
+        deferredRoots.insert(end(deferredRoots), begin(roots), end(roots));
+        return;
+    }
+
+    // Reversed depth first post order lists each node after everything it depends on. Roots are
+    // marked visited up front since they have been recreated already.
+    auto order = vector<ResourceNode*>{};
+    {
+        lock_guard<mutex> lock{graphMutex};
+        auto visited = unordered_set<ResourceNode*>(begin(roots), end(roots));
+        const function<void(ResourceNode*)> visit = [&](ResourceNode* node) {
+            for (auto dependent : node->dependents)
+                if (visited.insert(dependent).second) visit(dependent);
+            order.push_back(node);
+        };
+        for (auto root : roots)
+            for (auto dependent : root->dependents)
+                if (visited.insert(dependent).second) visit(dependent);
+        reverse(begin(order), end(order));
+        for (auto node : order) ++node->pins;
+    }
+    try {
+        for (auto node : order) node->recreateAfterDependency();
+    } catch (...) {
+        unpin(order);
+        throw;
+    }
+    unpin(order);
+}
+
+void ResourceNode::pin(const vector<ResourceNode*>& nodes) {
+    lock_guard<mutex> lock{graphMutex};
+    for (auto node : nodes) ++node->pins;
+}
+
+void ResourceNode::unpin(const vector<ResourceNode*>& nodes) {
+    lock_guard<mutex> lock{graphMutex};
+    for (auto node : nodes) --node->pins;
+}
+
+ResourceNode::Recording::Recording() { recordings.emplace_back(); }
+
+ResourceNode::Recording::~Recording() {
+    if (recording) recordings.pop_back();
+}
+
+vector<ResourceNode*> ResourceNode::Recording::finish() {
+    auto res = move(recordings.back());
+    recordings.pop_back();
+    recording = false;
+    sort(begin(res), end(res));
+    res.erase(unique(begin(res), end(res)), end(res));
+    return res;
+}
+
+ResourceRecreateBatch::ResourceRecreateBatch() { ++batchDepth; }
+
+ResourceRecreateBatch::~ResourceRecreateBatch() {
+    if (finished) return;
+    if (--batchDepth == 0) {
+        ResourceNode::unpin(deferredRoots);
+        deferredRoots.clear();
+    }
+}
+
+void ResourceRecreateBatch::finish() {
+    finished = true;
+    if (--batchDepth > 0) return;
+    const auto roots = move(deferredRoots);
+    deferredRoots.clear();
+    try {
+        ResourceNode::recreateDependents(roots);
+    } catch (...) {
+        ResourceNode::unpin(roots);
+        throw;
+    }
+    ResourceNode::unpin(roots);
+}
@@ -1,9 +1,20 @@
 #pragma once
 
+#include "threadpool.h"
+
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <numeric>
+#include <stdexcept>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -20,9 +31,8 @@
 // The intent is that the ResourceManager will be thread safe and able to perform most of the heavy
 // lifting of managing GPU resource lifetimes under D3D12 (where e.g. a resource cannot be freed
 // immediately when it is no longer referenced from game code but must be kept alive until we know
-// the GPU will no longer reference it which may be one or more frames later). Currently it is not
-// thread safe however and in particular hot loading will need some careful consideration to make
-// thread safe.
+// the GPU will no longer reference it which may be one or more frames later). get(), recreate()
+// and moving or destroying ResourceHandles are safe from any thread.
 //
 // Design Overview
 //
@@ -37,142 +47,614 @@
 // key is the descriptor struct that defines the render state for example.
 //
 // Hotloading is supported through the most complex aspect of the current implementation. Each entry
-// in a ResourceManager resource table keeps a list of pointers to all currently live
-// ResourceHandles for it's resource type. When a resource is hotloaded we can then go through and
-// update all the referencing handles. The idea behind this system is that hotloading is a
-// relatively rare operation and we don't want to pay any extra indirection cost when referencing
-// resources under normal conditions in order to support it (e.g. by looking up a resource every
-// time we want to use it). Instead we pay a higher cost when hotloading to update all references
-// since performance is not a major issue in this situation. You can think of it as an event rather
-// than polling model.
+// in a ResourceManager resource table keeps an intrusive doubly linked list of all currently live
+// ResourceHandles for it's resource type, and each handle points straight at its entry, so handles
+// are moved and destroyed without a hash lookup or a search of the list. When a resource is
+// hotloaded we can then go through and update all the referencing handles. The idea behind this
+// system is that hotloading is a relatively rare operation and we don't want to pay any extra
+// indirection cost when referencing resources under normal conditions in order to support it (e.g.
+// by looking up a resource every time we want to use it). Instead we pay a higher cost when
+// hotloading to update all references since performance is not a major issue in this situation. You
+// can think of it as an event rather than polling model.
+//
+// Thread safety comes from splitting the resource table into shards by key hash, each with its own
+// mutex, so threads requesting different resources rarely contend. A shard's lock covers its
+// entries and their live reference lists. Resources are created outside the lock since creation
+// can be slow (e.g. compiling a shader) and may request resources from other managers; if two
+// threads create the same resource at once the loser's copy is discarded. A handle's resource
+// pointer is atomic and only written under the shard lock, so recreate() can retarget handles
+// while other threads read them. A ResourceHandle itself is not synchronized, as with any other
+// object one thread must not move from or destroy a handle another thread is using.
+//
+// Resources are reference counted. When the last handle to a resource goes away, or recreate()
+// replaces it, it is retired rather than freed, tagged with the current frame. collect() is called
+// once a frame with the index of the last completed frame and frees resources retired at least
+// retireFrames before it, so raw pointers stay valid for the rest of the frame they were got in
+// and for as long as the GPU may still be using the resource. A retired entry that is requested
+// again before it is collected is simply revived.
 //
-// Hotloading will be more complex when the resource manager is made thread safe. Details still need
-// to be worked out there for how to handle safely updating resource pointers in arbitrary threads.
-// We may be ok with relying on atomic pointer writes to do the update and just lock the internal
-// structures. Since the resource manager should be accessed relatively infrequently (only when
-// requesting a new resource) the overhead of locking may not be too bad.
+// getAsync() keeps slow creation such as texture loads off the calling thread. It returns a
+// handle to a per manager placeholder straight away and creates the resource on the global
+// thread pool, then retargets the live handles exactly as a hotload does.
 //
-// Currently resource lifetime management is braindead - we just free everything when the manager is
-// destroyed - but it should be simple to extend the system to support reference counting since we
-// already track that information.
+// Resources can be built from resources in other managers, a pipeline state object from its
+// shaders and states for example. Whatever a manager gets while creating a resource is recorded as
+// a dependency of it, so recreating a resource also recreates everything built from it, see
+// ResourceNode below.
+//
+// Storing a ResourceHandle per element of a big array is costly since handles are tracked, so the
+// manager can also hand out SlotHandles: an index and generation into a table of slots each
+// holding an entry's current resource. They are plain values that don't keep the resource alive,
+// hotloading just updates the slot and a collected entry's slot gets a new generation so stale
+// SlotHandles resolve to null.
+
+// A resource table entry in the graph of dependencies between resources, across all managers.
+// Edges are guarded by one global mutex since they only change when resources are created,
+// recreated or freed.
+class ResourceNode {
+public:
+    ResourceNode() = default;
+    // Entries are only moved before they are in the graph
+    ResourceNode(ResourceNode&&) {}
+    ResourceNode& operator=(const ResourceNode&) = delete;
+    virtual ~ResourceNode();
+
+    // Recreate the resource after one it depends on has been recreated
+    virtual void recreateAfterDependency() = 0;
+
+    // Note a use of the node by the resource being created on this thread, if any
+    void recordUse();
+    // Make nodes the node's dependencies in place of its current ones
+    void setDependencies(const std::vector<ResourceNode*>& nodes);
+    // Remove the node from the graph so it can be freed, unless a recreate is about to visit it
+    bool tryRemove();
+
+    // Recreate everything depending on roots, directly or not, once each and after everything it
+    // depends on. Deferred to the end of the outermost ResourceRecreateBatch on this thread.
+    static void recreateDependents(const std::vector<ResourceNode*>& roots);
+
+    // Collects the nodes used on this thread while a resource is created. Creations nested inside
+    // another record their own uses.
+    class Recording {
+    public:
+        Recording();
+        Recording(const Recording&) = delete;
+        Recording& operator=(const Recording&) = delete;
+        ~Recording();
+
+        // Stop recording and return the nodes used, each once
+        std::vector<ResourceNode*> finish();
+
+    private:
+        bool recording = true;
+    };
+
+private:
+    friend class ResourceRecreateBatch;
+    static void pin(const std::vector<ResourceNode*>& nodes);
+    static void unpin(const std::vector<ResourceNode*>& nodes);
+    void unlinkDependencies();
+
+    std::vector<ResourceNode*> dependencies;
+    std::vector<ResourceNode*> dependents;
+    // Recreates that will visit the node, which can't be removed meanwhile
+    int pins = 0;
+};
+
+// Defers recreating the dependents of resources recreated on this thread until finish(), so that
+// a resource depending on several of them is only recreated once
+class ResourceRecreateBatch {
+public:
+    ResourceRecreateBatch();
+    ResourceRecreateBatch(const ResourceRecreateBatch&) = delete;
+    ResourceRecreateBatch& operator=(const ResourceRecreateBatch&) = delete;
+    ~ResourceRecreateBatch();
+
+    void finish();
+
+private:
+    bool finished = false;
+};
+
+// 2^n over the golden ratio for n the bits of a size_t of SizeBytes, the multiplier for Fibonacci
+// hashing in size_t arithmetic
+template <size_t SizeBytes>
+struct FibonacciHashMultiplier;
+template <>
+struct FibonacciHashMultiplier<4> : std::integral_constant<uint32_t, 0x9e3779b9u> {};
+template <>
+struct FibonacciHashMultiplier<8> : std::integral_constant<uint64_t, 0x9e3779b97f4a7c15u> {};
 
 template <typename Key, typename Resource, typename ResourceDeleter = std::default_delete<Resource>>
 class ResourceManagerBase {
+    struct ResourceOwner;
+
 public:
     using KeyType = Key;
     using ResourceType = Resource;
-    using ResourceManagerBaseType = ResourceManagerBase<KeyType, ResourceType>;
+    using ResourceManagerBaseType = ResourceManagerBase<KeyType, ResourceType, ResourceDeleter>;
 
     ResourceManagerBase() = default;
     ResourceManagerBase(const ResourceManagerBase&) = delete;
     ResourceManagerBase& operator=(const ResourceManagerBase&) = delete;
 
-    // ResourceHandles are tracking and (will be) threadsafe which makes them fairly expensive to
-    // copy so you don't want to pass them around by value. The system is designed so that a
-    // resource is not freed for 2 frames after the last ResourceHandle goes away so it is safe to
-    // pass raw Resources around within a frame. For this reason it is not possible to copy
-    // construct or assign a ResourceHandle.
+    // ResourceHandles are tracking and threadsafe which makes them fairly expensive to copy so you
+    // don't want to pass them around by value. The system is designed so that a resource is not
+    // freed for retireFrames frames after the last ResourceHandle goes away so it is safe to pass
+    // raw Resources around within a frame. For this reason it is not possible to copy construct or
+    // assign a ResourceHandle.
     friend class ResourceHandle;
     class ResourceHandle {
     public:
         ResourceHandle() = default;
         ResourceHandle(const ResourceHandle&) = delete;
-        ResourceHandle(ResourceHandle&& x) : owner{x.owner}, key{x.key}, resource{x.resource} {
-            owner->track(*key, *this);
+        ResourceHandle(ResourceHandle&& x) {
+            // The resource is read from the entry rather than x so a concurrent recreate can't be
+            // missed
+            if (x.entry) track(*x.entry, *this);
         }
-        ResourceHandle(ResourceManagerBase& owner_, const KeyType& key_, ResourceType& resource_)
-            : owner{&owner_}, key{&key_}, resource{&resource_} {
-            // This could be optimized since generally we just inserted the resource so no need to
-            // look it up again. It would complicate the code though.
-            owner->track(*key, *this);
+        ~ResourceHandle() {
+            if (entry) untrack(*entry, *this);
         }
-        ~ResourceHandle() { owner->untrack(key, *this); }
 
         ResourceHandle& operator=(const ResourceHandle&) = delete;
         ResourceHandle& operator=(ResourceHandle&& x) {
             if (this != &x) {
-                owner->untrack(key, *this);
-                owner = x.owner;
-                key = x.key;
-                resource = x.resource;
-                owner->track(*key, *this);
+                if (entry) untrack(*entry, *this);
+                if (x.entry) track(*x.entry, *this);
             }
             return *this;
         }
 
-        ResourceType* get() { return resource; }
+        ResourceType* get() { return resource.load(std::memory_order_acquire); }
 
     private:
-        friend class ResourceManagerBaseType;
-        ResourceManagerBase* owner = nullptr;
-        const KeyType* key = nullptr;
-        ResourceType* resource = nullptr;
+        friend class ResourceManagerBase;
+
+        ResourceOwner* entry = nullptr;
+        // Neighbours in entry's list of live references
+        ResourceHandle* previous = nullptr;
+        ResourceHandle* next = nullptr;
+        std::atomic<ResourceType*> resource{nullptr};
+    };
+
+    // Weak reference to a resource for storing in bulk, see slot() and resolve(). The default
+    // value is null.
+    struct SlotHandle {
+        uint32_t index = 0;
+        uint32_t generation = 0;
     };
 
+    // Frames a resource is kept after it is retired
+    static const uint64_t retireFrames = 2;
+
     ResourceHandle get(const Key& key) {
-        auto findIt = resourceTable.find(key);
-        if (findIt != resourceTable.end())
-            return ResourceHandle{*this, findIt->first, *findIt->second.resource.get()};
-        auto newIt =
-            resourceTable.emplace(std::make_pair(key, ResourceOwner(this, createResource(key))))
-                .first;
-        return ResourceHandle{*this, newIt->first, *newIt->second.resource.get()};
+        auto& shard = shardFor(key);
+        ResourceHandle handle;
+        {
+            std::lock_guard<std::mutex> lock{shard.mutex};
+            auto findIt = shard.table.find(key);
+            if (findIt != shard.table.end() && !findIt->second.loading)
+                link(findIt->second, handle);
+        }
+        if (!handle.entry) {
+            // Also created here if an async load is in progress since the caller needs the real
+            // resource now
+            ResourceNode::Recording recording;
+            auto created = std::unique_ptr<ResourceType, ResourceDeleter>{createResource(key)};
+            const auto dependencies = recording.finish();
+            std::lock_guard<std::mutex> lock{shard.mutex};
+            auto inserted = shard.table.emplace(key, ResourceOwner{this, &shard, nullptr});
+            auto& entry = inserted.first->second;
+            if (inserted.second) entry.key = &inserted.first->first;
+            // If another thread created the resource first ours is dropped
+            if (inserted.second || entry.loading) {
+                entry.loading = false;
+                install(entry, std::move(created));
+                entry.setDependencies(dependencies);
+            }
+            link(entry, handle);
+        }
+        // The handle is linked under the lock so collect() can't free the entry in between
+        return handle;
+    }
+
+    // Like get() but never waits for creation. A new resource is created on the global thread
+    // pool, until it is ready handles to it refer to the placeholder from createPlaceholder().
+    // Exceptions thrown creating it, and creation returning null, are reported from the next
+    // collect(). Handles stay on the placeholder after a failed load and the next getAsync() or
+    // get() of the key tries again.
+    ResourceHandle getAsync(const Key& key) {
+        std::call_once(placeholderCreated, [this] { placeholder.reset(createPlaceholder()); });
+        auto& shard = shardFor(key);
+        ResourceHandle handle;
+        ResourceOwner* load = nullptr;
+        {
+            std::lock_guard<std::mutex> lock{shard.mutex};
+            auto findIt = shard.table.find(key);
+            if (findIt == shard.table.end()) {
+                findIt = shard.table.emplace(key, ResourceOwner{this, &shard, nullptr}).first;
+                findIt->second.key = &findIt->first;
+                findIt->second.loading = true;
+            }
+            auto& entry = findIt->second;
+            if (entry.loading && !entry.loadPending) {
+                load = &entry;
+                load->loadPending = true;
+                // Held by the load until it finishes
+                ++load->references;
+            }
+            link(entry, handle);
+        }
+        if (load) {
+            {
+                std::lock_guard<std::mutex> lock{pendingLoadsMutex};
+                ++pendingLoads;
+            }
+            ThreadPool::global().submit([this, load] { finishLoad(*load); });
+        }
+        return handle;
+    }
+
+    // The SlotHandle for handle's resource, which resolves to it for as long as its entry lives
+    SlotHandle slot(const ResourceHandle& handle) {
+        assert(handle.entry && "Can't get the slot of a null handle");
+        auto& entry = *handle.entry;
+        std::lock_guard<std::mutex> lock{entry.shard->mutex};
+        if (!entry.slotIndex) {
+            entry.slotIndex = allocateSlot();
+            slotAt(entry.slotIndex).resource.store(current(entry), std::memory_order_release);
+        }
+        return {entry.slotIndex, slotAt(entry.slotIndex).generation.load()};
+    }
+
+    // The resource handle's slot holds, null if its entry has been collected. As with a raw
+    // resource from a ResourceHandle it stays valid for the rest of the frame.
+    ResourceType* resolve(const SlotHandle& handle) const {
+        if (!handle.index) return nullptr;
+        const auto& slot = slotAt(handle.index);
+        const auto resource = slot.resource.load(std::memory_order_acquire);
+        // Read after the resource so a slot freed and reused meanwhile isn't taken for ours
+        return slot.generation.load(std::memory_order_acquire) == handle.generation ? resource
+                                                                                    : nullptr;
     }
 
     void recreate(const Key& key) {
-        auto findIt = resourceTable.find(key);
-        if (findIt != resourceTable.end()) recreate(*findIt);
+        auto& shard = shardFor(key);
+        ResourceOwner* entry = nullptr;
+        {
+            std::lock_guard<std::mutex> lock{shard.mutex};
+            auto findIt = shard.table.find(key);
+            if (findIt == shard.table.end()) return;
+            entry = &findIt->second;
+            ++entry->references;
+        }
+        recreateEntries({entry});
     }
 
     void recreateAll() {
-        for (auto& e : resourceTable) {
-            recreate(e);
+        recreateIf([](const KeyType&, const ResourceType*) { return true; });
+    }
+
+    // Recreate the resources for which pred(key, resource) is true, resource may be null if
+    // creation failed. pred is called with the shard locked so it must not use this manager.
+    template <typename Pred>
+    void recreateIf(Pred pred) {
+        auto entries = std::vector<ResourceOwner*>{};
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> lock{shard.mutex};
+            for (auto& e : shard.table) {
+                if (!pred(e.first, e.second.resource.get())) continue;
+                ++e.second.references;
+                entries.push_back(&e.second);
+            }
+        }
+        recreateEntries(entries);
+    }
+
+    // Free resources retired at least retireFrames before completedFrame. Called once a frame with
+    // increasing frame indices, resources retired until the next call are tagged
+    // completedFrame + 1.
+    void collect(uint64_t completedFrame) {
+        auto error = std::exception_ptr{};
+        {
+            std::lock_guard<std::mutex> lock{pendingLoadsMutex};
+            std::swap(error, loadError);
+        }
+        if (error) std::rethrow_exception(error);
+
+        currentFrame.store(completedFrame + 1);
+        for (auto& shard : shards) {
+            // Freed outside the lock
+            auto freed = std::vector<std::unique_ptr<ResourceType, ResourceDeleter>>{};
+            {
+                std::lock_guard<std::mutex> lock{shard.mutex};
+                auto& entries = shard.retiredEntries;
+                const auto collected = [&](ResourceOwner* entry) {
+                    if (entry->references > 0) {
+                        entry->retirePending = false;
+                        return true;
+                    }
+                    if (entry->retiredFrame + retireFrames > completedFrame) return false;
+                    if (!entry->tryRemove()) return false;
+                    if (entry->slotIndex) {
+                        freeSlot(entry->slotIndex);
+                        // resolve() may have read the slot just before, so the resource is
+                        // kept for the frames a raw resource is promised to stay valid
+                        shard.retiredResources.emplace_back(completedFrame + 1,
+                                                            std::move(entry->resource));
+                    } else {
+                        freed.push_back(std::move(entry->resource));
+                    }
+                    shard.table.erase(shard.table.find(*entry->key));
+                    return true;
+                };
+                entries.erase(std::remove_if(begin(entries), end(entries), collected),
+                              end(entries));
+                auto& resources = shard.retiredResources;
+                const auto expired = [completedFrame](const auto& r) {
+                    return r.first + retireFrames <= completedFrame;
+                };
+                const auto firstKept = std::partition(begin(resources), end(resources), expired);
+                for (auto it = begin(resources); it != firstKept; ++it)
+                    freed.push_back(std::move(it->second));
+                resources.erase(begin(resources), firstKept);
+            }
         }
     }
 
 protected:
     virtual ~ResourceManagerBase() {
-        assert(std::all_of(begin(resourceTable), end(resourceTable),
-                           [](const auto& e) { return e.second.liveReferences.empty(); }) &&
+        assert(std::all_of(begin(shards), end(shards),
+                           [](const auto& shard) {
+                               return std::all_of(begin(shard.table), end(shard.table),
+                                                  [](const auto& e) {
+                                                      return !e.second.firstReference;
+                                                  });
+                           }) &&
                ("All resource handles tracked by a ResourceManager should be destroyed before "
                 "it is destroyed."));
+        assert(pendingLoads == 0 &&
+               "Managers using getAsync() must call finishPendingLoads() from their destructor.");
+    }
+
+    // Wait for getAsync() loads in progress. Loads call createResource() so a manager that uses
+    // getAsync() must call this from its destructor.
+    void finishPendingLoads() {
+        std::unique_lock<std::mutex> lock{pendingLoadsMutex};
+        loadsDone.wait(lock, [this] { return pendingLoads == 0; });
     }
 
 private:
-    struct ResourceOwner {
+    struct Shard;
+    struct ResourceOwner : ResourceNode {
         ResourceOwner() = default;
-        explicit ResourceOwner(ResourceManagerBase* owner_, Resource* resource_)
-            : owner{owner_}, resource{resource_} {}
+        explicit ResourceOwner(ResourceManagerBase* owner_, Shard* shard_, Resource* resource_)
+            : owner{owner_}, shard{shard_}, resource{resource_} {}
+        void recreateAfterDependency() override { owner->recreateResource(*this); }
         ResourceManagerBase* owner = nullptr;
-        std::vector<ResourceHandle*> liveReferences;
+        Shard* shard = nullptr;
+        const KeyType* key = nullptr;
+        // The rest is guarded by the shard's lock. references counts live handles plus recreates
+        // in progress, which keep the entry from being collected.
+        ResourceHandle* firstReference = nullptr;
+        int references = 0;
+        uint64_t retiredFrame = 0;
+        // Whether handles refer to the placeholder, until getAsync() creates the resource
+        bool loading = false;
+        // Whether a getAsync() load is in progress, a loading entry without one has failed
+        bool loadPending = false;
+        // Whether the entry is in the shard's retiredEntries
+        bool retirePending = false;
+        // The entry's slot once slot() has been asked for it, 0 before
+        uint32_t slotIndex = 0;
         std::unique_ptr<ResourceType, ResourceDeleter> resource;
     };
     using ResourceTable = std::unordered_map<KeyType, ResourceOwner>;
+    using RetiredResource = std::pair<uint64_t, std::unique_ptr<ResourceType, ResourceDeleter>>;
+
+    struct Shard {
+        std::mutex mutex;
+        ResourceTable table;
+        // Entries whose references dropped to zero, some may have been revived since
+        std::vector<ResourceOwner*> retiredEntries;
+        // Resources replaced by recreate() and the frame they were retired in
+        std::vector<RetiredResource> retiredResources;
+    };
+    static const int numShardBits = 4;
+
+    // Slots are allocated in fixed size chunks that never move, so resolve() can read them while
+    // slots are allocated on other threads
+    struct Slot {
+        std::atomic<ResourceType*> resource{nullptr};
+        std::atomic<uint32_t> generation{1};
+    };
+    static const uint32_t slotChunkBits = 12;
+    static const uint32_t maxSlotChunks = 1024;
 
     virtual ResourceType* createResource(const Key& key) = 0;
+    // Resource handles from getAsync() refer to while it is created, called once on first use
+    virtual ResourceType* createPlaceholder() { return nullptr; }
+
+    Shard& shardFor(const KeyType& key) {
+        // Fibonacci hashing picks the shard from the top bits, the shard's table buckets by the
+        // low bits of the same hash and would only use a fraction of its buckets otherwise. The
+        // multiplier must match the width of size_t for every bit of the hash to reach the top.
+        const auto hash = static_cast<size_t>(std::hash<KeyType>{}(key) *
+                                              FibonacciHashMultiplier<sizeof(size_t)>::value);
+        return shards[hash >> (sizeof(size_t) * 8 - numShardBits)];
+    }
 
-    void track(const KeyType& key, ResourceHandle& handle) {
-        resourceTable[key].liveReferences.push_back(&handle);
+    // link(), unlink(), release() and install() expect the entry's shard to be locked
+    static void link(ResourceOwner& entry, ResourceHandle& handle) {
+        entry.recordUse();
+        handle.entry = &entry;
+        handle.previous = nullptr;
+        handle.next = entry.firstReference;
+        if (handle.next) handle.next->previous = &handle;
+        entry.firstReference = &handle;
+        ++entry.references;
+        handle.resource.store(current(entry), std::memory_order_release);
     }
-    void untrack(const KeyType* key, ResourceHandle& handle) {
-        if (key) {
-            auto& refs = resourceTable[*key].liveReferences;
-            auto findIt = std::find(std::begin(refs), std::end(refs), &handle);
-            assert(findIt != end(refs));
-            refs.erase(findIt);
+    // What handles to entry refer to
+    static ResourceType* current(const ResourceOwner& entry) {
+        return entry.loading ? entry.owner->placeholder.get() : entry.resource.get();
+    }
+    static void unlink(ResourceOwner& entry, ResourceHandle& handle) {
+        if (handle.previous)
+            handle.previous->next = handle.next;
+        else
+            entry.firstReference = handle.next;
+        if (handle.next) handle.next->previous = handle.previous;
+        handle.entry = nullptr;
+        handle.resource.store(nullptr, std::memory_order_release);
+        release(entry);
+    }
+    static void release(ResourceOwner& entry) {
+        if (--entry.references > 0) return;
+        entry.retiredFrame = entry.owner->currentFrame.load();
+        if (entry.retirePending) return;
+        entry.retirePending = true;
+        entry.shard->retiredEntries.push_back(&entry);
+    }
+
+    static void track(ResourceOwner& entry, ResourceHandle& handle) {
+        std::lock_guard<std::mutex> lock{entry.shard->mutex};
+        link(entry, handle);
+    }
+    static void untrack(ResourceOwner& entry, ResourceHandle& handle) {
+        std::lock_guard<std::mutex> lock{entry.shard->mutex};
+        unlink(entry, handle);
+    }
+
+    // Make resource entry's and retarget its handles, retiring the resource it replaces
+    static void install(ResourceOwner& entry,
+                        std::unique_ptr<ResourceType, ResourceDeleter> resource) {
+        const auto installed = resource.get();
+        swap(entry.resource, resource);
+        for (auto ref = entry.firstReference; ref; ref = ref->next)
+            ref->resource.store(installed, std::memory_order_release);
+        if (entry.slotIndex)
+            entry.owner->slotAt(entry.slotIndex).resource.store(installed,
+                                                                 std::memory_order_release);
+        if (resource) {
+            entry.shard->retiredResources.emplace_back(entry.owner->currentFrame.load(),
+                                                       std::move(resource));
+        }
+    }
+
+    // Recreate a resource whose entry is kept by the caller, returns whether it was replaced
+    bool recreateResource(ResourceOwner& entry) {
+        ResourceNode::Recording recording;
+        auto recreated = std::unique_ptr<ResourceType, ResourceDeleter>{createResource(*entry.key)};
+        if (!recreated) return false;
+        const auto dependencies = recording.finish();
+        std::lock_guard<std::mutex> lock{entry.shard->mutex};
+        entry.loading = false;
+        install(entry, std::move(recreated));
+        entry.setDependencies(dependencies);
+        return true;
+    }
+
+    // Recreate entries the caller has added references to, then everything depending on them,
+    // and release the references
+    void recreateEntries(const std::vector<ResourceOwner*>& entries) {
+        const auto releaseAll = [&entries] {
+            for (auto entry : entries) {
+                std::lock_guard<std::mutex> lock{entry->shard->mutex};
+                release(*entry);
+            }
+        };
+        try {
+            auto recreated = std::vector<ResourceNode*>{};
+            for (auto entry : entries)
+                if (recreateResource(*entry)) recreated.push_back(entry);
+            ResourceNode::recreateDependents(recreated);
+        } catch (...) {
+            releaseAll();
+            throw;
         }
+        releaseAll();
     }
 
-    void recreate(typename ResourceTable::value_type& entry) {
-        auto recreated = createResource(entry.first);
-        auto& resourceOwner = entry.second;
-        if (recreated) {
-            resourceOwner.resource.reset(recreated);
-            for (auto& ref : resourceOwner.liveReferences) {
-                ref->resource = recreated;
+    // Body of a getAsync() load, releases the reference it holds on entry
+    void finishLoad(ResourceOwner& entry) {
+        auto created = std::unique_ptr<ResourceType, ResourceDeleter>{};
+        auto error = std::exception_ptr{};
+        try {
+            ResourceNode::Recording recording;
+            created.reset(createResource(*entry.key));
+            const auto dependencies = recording.finish();
+            auto installed = false;
+            {
+                std::lock_guard<std::mutex> lock{entry.shard->mutex};
+                // A get() or recreate() may have replaced the placeholder already, ours is
+                // dropped then
+                if (entry.loading) {
+                    if (!created) throw std::runtime_error{"Async resource load returned null"};
+                    entry.loading = false;
+                    install(entry, std::move(created));
+                    entry.setDependencies(dependencies);
+                    installed = true;
+                }
             }
+            // Anything created from the placeholder meanwhile
+            if (installed) ResourceNode::recreateDependents({&entry});
+        } catch (...) {
+            error = std::current_exception();
+        }
+        {
+            // A failed load leaves the entry loading so the next getAsync() starts another
+            std::lock_guard<std::mutex> lock{entry.shard->mutex};
+            entry.loadPending = false;
+            release(entry);
         }
+        std::lock_guard<std::mutex> lock{pendingLoadsMutex};
+        if (error && !loadError) loadError = error;
+        if (--pendingLoads == 0) loadsDone.notify_all();
+    }
+
+    Slot& slotAt(uint32_t index) {
+        return slotChunks[index >> slotChunkBits][index & ((1u << slotChunkBits) - 1)];
+    }
+    const Slot& slotAt(uint32_t index) const {
+        return slotChunks[index >> slotChunkBits][index & ((1u << slotChunkBits) - 1)];
+    }
+
+    uint32_t allocateSlot() {
+        std::lock_guard<std::mutex> lock{slotsMutex};
+        if (!freeSlots.empty()) {
+            const auto index = freeSlots.back();
+            freeSlots.pop_back();
+            return index;
+        }
+        const auto chunk = nextSlot >> slotChunkBits;
+        if (chunk >= maxSlotChunks) throw std::runtime_error{"Out of resource slots"};
+        if (!slotChunks[chunk]) slotChunks[chunk] = std::make_unique<Slot[]>(size_t{1} << slotChunkBits);
+        return nextSlot++;
+    }
+
+    // The new generation is published before the slot is cleared, see resolve()
+    void freeSlot(uint32_t index) {
+        auto& slot = slotAt(index);
+        slot.generation.store(slot.generation.load() + 1, std::memory_order_release);
+        slot.resource.store(nullptr, std::memory_order_release);
+        std::lock_guard<std::mutex> lock{slotsMutex};
+        freeSlots.push_back(index);
     }
 
-    ResourceTable resourceTable;
+    std::atomic<uint64_t> currentFrame{0};
+    std::once_flag placeholderCreated;
+    std::unique_ptr<ResourceType, ResourceDeleter> placeholder;
+    // Loads in progress and the first exception one threw since the last collect()
+    std::mutex pendingLoadsMutex;
+    std::condition_variable loadsDone;
+    int pendingLoads = 0;
+    std::exception_ptr loadError;
+    std::array<Shard, 1 << numShardBits> shards;
+    // Slot 0 is never used so that a default SlotHandle is null
+    std::mutex slotsMutex;
+    std::array<std::unique_ptr<Slot[]>, maxSlotChunks> slotChunks;
+    std::vector<uint32_t> freeSlots;
+    uint32_t nextSlot = 1;
 };
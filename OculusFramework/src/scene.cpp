@@ -1,8 +1,10 @@
 #include "scene.h"
 
+#include "mipchain.h"
 #include "pipelinestateobject.h"
 #include "util.h"
 
+#include <cstring>
 #include <iterator>
 #include <vector>
 
@@ -72,30 +74,18 @@ Texture::Texture(const char* name_, ID3D11Device* device, ID3D11DeviceContext* d
         device, Texture2DDesc(DXGI_FORMAT_R8G8B8A8_UNORM_SRGB, size.w, size.h).mipLevels(mipLevels),
         "ImageBuffer::Tex - "s + name);
 
-    if (data)  // Note data is trashed, as is width and height
-    {
-        for (int level = 0; level < mipLevels; level++) {
-            deviceContext->UpdateSubresource(Tex.Get(), level, NULL, data, size.w * 4, size.h * 4);
-            for (int j = 0; j < (size.h & ~1); j += 2) {
-                const uint8_t* psrc = data + (size.w * j * 4);
-                uint8_t* pdest = data + ((size.w >> 1) * (j >> 1) * 4);
-                for (int i = 0; i<size.w>> 1; i++, psrc += 8, pdest += 4) {
-                    pdest[0] =
-                        (((int)psrc[0]) + psrc[4] + psrc[size.w * 4 + 0] + psrc[size.w * 4 + 4]) >>
-                        2;
-                    pdest[1] =
-                        (((int)psrc[1]) + psrc[5] + psrc[size.w * 4 + 1] + psrc[size.w * 4 + 5]) >>
-                        2;
-                    pdest[2] =
-                        (((int)psrc[2]) + psrc[6] + psrc[size.w * 4 + 2] + psrc[size.w * 4 + 6]) >>
-                        2;
-                    pdest[3] =
-                        (((int)psrc[3]) + psrc[7] + psrc[size.w * 4 + 3] + psrc[size.w * 4 + 7]) >>
-                        2;
-                }
-            }
-            size.w >>= 1;
-            size.h >>= 1;
+    if (data) {
+        // The texture is sRGB so average in linear space
+        auto image = RgbaImage{size.w, size.h};
+        for (int y = 0; y < size.h; ++y)
+            memcpy(image.row(y), data + size_t(y) * size.w * 4, size_t(size.w) * 4);
+        auto options = MipChainOptions{};
+        options.srgb = true;
+        const auto mips = MipChain{move(image), options, mipLevels};
+        for (int level = 0; level < mips.numLevels(); ++level) {
+            const auto& mip = mips.level(level);
+            deviceContext->UpdateSubresource(Tex.Get(), level, nullptr, mip.data(),
+                                             to<UINT>(mip.rowPitch()), 0);
         }
     }
 }
@@ -322,6 +312,6 @@ void Scene::Render(DirectX11& dx11, const mathlib::Vec3f& eye, const mathlib::Ma
                *model->objectConstantBuffer.Get());
     }
 
-    heightField->Render(dx11, dx11.Context.Get());
+    heightField->Render(dx11, dx11.Context.Get(), eye);
     sphere->Render(dx11, dx11.Context.Get());
 }
@@ -0,0 +1,242 @@
+#include "simplify.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <set>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+
+using namespace mathlib;
+
+namespace {
+
+const auto alwaysKeep = numeric_limits<float>::infinity();
+
+float distanceToSegment(const Vec2f& p, const Vec2f& a, const Vec2f& b) {
+    const auto ab = b - a;
+    const auto ap = p - a;
+    const auto lengthSq = ab.x() * ab.x() + ab.y() * ab.y();
+    const auto t =
+        lengthSq > 0.0f ? max(0.0f, min(1.0f, (ap.x() * ab.x() + ap.y() * ab.y()) / lengthSq))
+                        : 0.0f;
+    const auto d = ap - ab * t;
+    return sqrt(d.x() * d.x() + d.y() * d.y());
+}
+
+// Douglas-Peucker over points[first..last] assuming first and last are already kept with the
+// given significance
+void simplifyRange(gsl::array_view<const Vec2f> points, int first, int last,
+                   float parentSignificance, gsl::array_view<float> significance) {
+    // Explicit stack, long creeks can have thousands of points and recursion depth is O(n) worst
+    // case
+    auto ranges = vector<tuple<int, int, float>>{make_tuple(first, last, parentSignificance)};
+    while (!ranges.empty()) {
+        int a, b;
+        float parent;
+        tie(a, b, parent) = ranges.back();
+        ranges.pop_back();
+        if (b - a < 2) continue;
+        auto maxDist = -1.0f;
+        auto split = a + 1;
+        for (int i = a + 1; i < b; ++i) {
+            const auto dist = distanceToSegment(points[i], points[a], points[b]);
+            if (dist > maxDist) {
+                maxDist = dist;
+                split = i;
+            }
+        }
+        significance[split] = min(maxDist, parent);
+        ranges.emplace_back(a, split, significance[split]);
+        ranges.emplace_back(split, b, significance[split]);
+    }
+}
+
+// Whether segments ab and cd cross at a point interior to both. Segments that only touch, such as
+// neighbours in a ring, don't count.
+bool segmentsCross(const Vec2f& a, const Vec2f& b, const Vec2f& c, const Vec2f& d) {
+    const auto orient = [](const Vec2f& p, const Vec2f& q, const Vec2f& r) {
+        return (q.x() - p.x()) * (r.y() - p.y()) - (q.y() - p.y()) * (r.x() - p.x());
+    };
+    const auto opposite = [](float x, float y) {
+        return (x > 0.0f && y < 0.0f) || (x < 0.0f && y > 0.0f);
+    };
+    return opposite(orient(a, b, c), orient(a, b, d)) && opposite(orient(c, d, a), orient(c, d, b));
+}
+
+}  // namespace
+
+void polylineSignificance(gsl::array_view<const Vec2f> points, gsl::array_view<float> res) {
+    assert(points.size() == res.size());
+    const auto n = static_cast<int>(points.size());
+    fill(begin(res), end(res), alwaysKeep);
+    if (n > 2) simplifyRange(points, 0, n - 1, alwaysKeep, res);
+}
+
+void ringSignificance(gsl::array_view<const Vec2f> ring, gsl::array_view<float> res) {
+    assert(ring.size() == res.size());
+    const auto n = static_cast<int>(ring.size());
+    fill(begin(res), end(res), alwaysKeep);
+    if (n < 5) return;  // already a triangle or less
+
+    // Split the ring at the point farthest from its start and simplify each half as a polyline,
+    // the last point duplicates the first so stays at alwaysKeep
+    auto farthest = 1;
+    auto farthestDistSq = -1.0f;
+    for (int i = 1; i < n - 1; ++i) {
+        const auto d = ring[i] - ring[0];
+        const auto distSq = d.x() * d.x() + d.y() * d.y();
+        if (distSq > farthestDistSq) {
+            farthestDistSq = distSq;
+            farthest = i;
+        }
+    }
+    simplifyRange(ring, 0, farthest, alwaysKeep, res);
+    simplifyRange(ring, farthest, n - 1, alwaysKeep, res);
+
+    // Anchor a third point, the most significant remaining one, so the ring keeps some area.
+    // Raising it doesn't break nesting since everything it split is still bounded by it.
+    auto third = -1;
+    for (int i = 1; i < n - 1; ++i) {
+        if (i != farthest && (third < 0 || res[i] > res[third])) third = i;
+    }
+    if (third >= 0) res[third] = alwaysKeep;
+}
+
+void preserveRingTopology(gsl::array_view<const Vec2f> points, gsl::array_view<const int> ringEnds,
+                          gsl::array_view<float> res) {
+    assert(points.size() == res.size());
+    const auto n = static_cast<int>(points.size());
+    const auto numRings = static_cast<int>(ringEnds.size());
+    if (n == 0) return;
+    assert(ringEnds[numRings - 1] == n);
+
+    auto ringOf = vector<int>(n);
+    for (int ring = 0, i = 0; ring < numRings; ++ring)
+        for (; i < ringEnds[ring]; ++i) ringOf[i] = ring;
+    // Indices of the points of each ring kept at the current level, and for each kept point the
+    // next one in its ring
+    auto kept = vector<set<int>>(numRings);
+    auto nextKept = vector<int>(n, -1);
+
+    // Segments between consecutive kept points of a ring go in the cells of a uniform grid over
+    // the polygon that their bounds overlap. Segments split since they were added are removed
+    // from cells as they are found.
+    struct Segment {
+        int a, b;
+    };
+    auto minX = points[0].x(), maxX = minX, minY = points[0].y(), maxY = minY;
+    for (const auto& p : points) {
+        minX = min(minX, p.x());
+        maxX = max(maxX, p.x());
+        minY = min(minY, p.y());
+        maxY = max(maxY, p.y());
+    }
+    const auto gridSize = max(1, min(256, static_cast<int>(sqrt(float(n))) / 2));
+    const auto cellsPerX = gridSize / max(maxX - minX, 1e-6f);
+    const auto cellsPerY = gridSize / max(maxY - minY, 1e-6f);
+    auto cells = vector<vector<Segment>>(size_t(gridSize) * gridSize);
+    const auto cellX = [&](float x) {
+        return max(0, min(gridSize - 1, static_cast<int>((x - minX) * cellsPerX)));
+    };
+    const auto cellY = [&](float y) {
+        return max(0, min(gridSize - 1, static_cast<int>((y - minY) * cellsPerY)));
+    };
+    const auto forEachCell = [&](const Segment& s, auto f) {
+        const auto& a = points[s.a];
+        const auto& b = points[s.b];
+        for (int y = cellY(min(a.y(), b.y())); y <= cellY(max(a.y(), b.y())); ++y)
+            for (int x = cellX(min(a.x(), b.x())); x <= cellX(max(a.x(), b.x())); ++x)
+                f(cells[size_t(y) * gridSize + x]);
+    };
+    const auto isKeptSegment = [&nextKept](const Segment& s) { return nextKept[s.a] == s.b; };
+
+    // Segments added at the current level and not yet checked for crossings
+    auto unchecked = vector<Segment>{};
+    const auto addSegment = [&](int a, int b) {
+        const auto s = Segment{a, b};
+        forEachCell(s, [&s](vector<Segment>& cell) { cell.push_back(s); });
+        unchecked.push_back(s);
+    };
+    const auto keep = [&](int i, float level) {
+        res[i] = level;
+        auto& ring = kept[ringOf[i]];
+        const auto it = ring.insert(i).first;
+        nextKept[*prev(it)] = i;
+        nextKept[i] = *next(it);
+        addSegment(*prev(it), i);
+        addSegment(i, *next(it));
+    };
+    // Keep the most significant point s drops at level, false if it drops none
+    const auto split = [&](const Segment& s, float level) {
+        if (s.b - s.a < 2) return false;
+        auto splitAt = s.a + 1;
+        for (int i = s.a + 2; i < s.b; ++i)
+            if (res[i] > res[splitAt]) splitAt = i;
+        keep(splitAt, level);
+        return true;
+    };
+    // Split the unchecked segments and those they cross until nothing crosses at level
+    const auto resolveCrossings = [&](float level) {
+        while (!unchecked.empty()) {
+            const auto s = unchecked.back();
+            unchecked.pop_back();
+            if (!isKeptSegment(s)) continue;
+            auto crossed = false;
+            auto other = Segment{};
+            forEachCell(s, [&](vector<Segment>& cell) {
+                for (size_t i = 0; i < cell.size() && !crossed;) {
+                    const auto t = cell[i];
+                    if (!isKeptSegment(t)) {
+                        cell[i] = cell.back();
+                        cell.pop_back();
+                        continue;
+                    }
+                    ++i;
+                    // Crossings at full detail can't be removed
+                    if (s.b - s.a < 2 && t.b - t.a < 2) continue;
+                    if (!segmentsCross(points[s.a], points[s.b], points[t.a], points[t.b]))
+                        continue;
+                    crossed = true;
+                    other = t;
+                }
+            });
+            if (!crossed) continue;
+            split(other, level);
+            // Check s again against its other neighbours if it couldn't be split
+            if (!split(s, level)) unchecked.push_back(s);
+        }
+    };
+
+    // The always kept points form the coarsest level
+    for (int ring = 0; ring < numRings; ++ring) {
+        auto previous = -1;
+        for (int i = ring > 0 ? ringEnds[ring - 1] : 0; i < ringEnds[ring]; ++i) {
+            if (res[i] < alwaysKeep) continue;
+            kept[ring].insert(i);
+            if (previous >= 0) {
+                nextKept[previous] = i;
+                addSegment(previous, i);
+            }
+            previous = i;
+        }
+    }
+    resolveCrossings(alwaysKeep);
+
+    // Then points are added a level at a time, most significant first
+    auto order = vector<int>{};
+    for (int i = 0; i < n; ++i)
+        if (res[i] < alwaysKeep) order.push_back(i);
+    stable_sort(begin(order), end(order), [&res](int a, int b) { return res[a] > res[b]; });
+    for (const auto i : order) {
+        // Points kept to separate crossings are already in
+        if (nextKept[i] >= 0) continue;
+        const auto level = res[i];
+        keep(i, level);
+        resolveCrossings(level);
+    }
+}
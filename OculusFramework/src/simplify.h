@@ -0,0 +1,38 @@
+#pragma once
+
+#include "vector.h"
+
+#pragma warning(push)
+#pragma warning(disable : 4245)
+#include <array_view.h>
+#pragma warning(pop)
+
+// Multi level Douglas-Peucker simplification. Rather than storing a separate simplified copy of a
+// shape per level, each point gets a significance: the largest tolerance at which Douglas-Peucker
+// would still keep it (clamped to its parent split's significance so levels nest). Simplifying at
+// tolerance t keeps exactly the points with significance > t so one pass at load time gives every
+// level and the renderer picks a level by filtering.
+
+// Significance of each point of an open polyline, the endpoints are always kept. significance
+// must be the same size as points.
+void polylineSignificance(gsl::array_view<const mathlib::Vec2f> points,
+                          gsl::array_view<float> significance);
+
+// Significance of each point of a closed ring whose last point repeats the first. The ring is
+// anchored at three points that are always kept so it never collapses below a triangle. Rings are
+// simplified independently, preserveRingTopology() then keeps them from crossing.
+void ringSignificance(gsl::array_view<const mathlib::Vec2f> ring,
+                      gsl::array_view<float> significance);
+
+// Raise the significance of points of a polygon's rings from ringSignificance() so that at no
+// tolerance does a simplified ring cross itself or another of the rings, provided none cross at
+// full detail. Ring i is points [ringEnds[i - 1], ringEnds[i]) with ringEnds[-1] taken as 0.
+// Levels are visited coarsest first, and where a segment added at a level crosses another the
+// most significant dropped point of each is kept at that level too, until nothing crosses.
+void preserveRingTopology(gsl::array_view<const mathlib::Vec2f> points,
+                          gsl::array_view<const int> ringEnds,
+                          gsl::array_view<float> significance);
+
+// Tolerance in source units giving at most quarter pixel error when rendered at outputScale
+// pixels per source unit
+inline float simplificationTolerance(float outputScale) { return 0.25f / outputScale; }
@@ -0,0 +1,161 @@
+#include "spatialindex.h"
+
+#include "mathfuncs.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <queue>
+#include <utility>
+
+using namespace std;
+
+using namespace mathlib;
+using namespace util;
+
+PointSpatialIndex::PointSpatialIndex(gsl::array_view<const Vec2f> points,
+                                     int targetPointsPerCell) {
+    if (points.size() == 0) return;
+
+    boundsMin = boundsMax = points[0];
+    for (const auto& p : points) {
+        boundsMin = {min(boundsMin.x(), p.x()), min(boundsMin.y(), p.y())};
+        boundsMax = {max(boundsMax.x(), p.x()), max(boundsMax.y(), p.y())};
+    }
+
+    // Choose a roughly square cell size giving targetPointsPerCell points per cell on average
+    const auto numPoints = to<int>(points.size());
+    const auto extent = boundsMax - boundsMin;
+    const auto area = max(extent.x(), 1e-6f) * max(extent.y(), 1e-6f);
+    const auto targetCells = max(1, numPoints / max(1, targetPointsPerCell));
+    const auto side = sqrt(area / targetCells);
+    cellsX = mathlib::clamp(to<int>(ceil(extent.x() / side)), 1, 4096);
+    cellsY = mathlib::clamp(to<int>(ceil(extent.y() / side)), 1, 4096);
+    cellSize = {max(extent.x(), 1e-6f) / cellsX, max(extent.y(), 1e-6f) / cellsY};
+    invCellSize = {1.0f / cellSize.x(), 1.0f / cellSize.y()};
+
+    // Counting sort of the points into cells
+    auto pointCells = vector<int>(numPoints);
+    cellStarts.assign(cellsX * cellsY + 1, 0);
+    for (int i = 0; i < numPoints; ++i) {
+        pointCells[i] = cellY(points[i].y()) * cellsX + cellX(points[i].x());
+        ++cellStarts[pointCells[i] + 1];
+    }
+    partial_sum(begin(cellStarts), end(cellStarts), begin(cellStarts));
+    auto cellFill = vector<int>(begin(cellStarts), end(cellStarts) - 1);
+    sortedPoints.resize(numPoints);
+    sortedIndices.resize(numPoints);
+    for (int i = 0; i < numPoints; ++i) {
+        const auto dest = cellFill[pointCells[i]]++;
+        sortedPoints[dest] = points[i];
+        sortedIndices[dest] = i;
+    }
+}
+
+int PointSpatialIndex::cellX(float x) const {
+    const auto cell = static_cast<int>((x - boundsMin.x()) * invCellSize.x());
+    return mathlib::clamp(cell, 0, cellsX - 1);
+}
+
+int PointSpatialIndex::cellY(float y) const {
+    const auto cell = static_cast<int>((y - boundsMin.y()) * invCellSize.y());
+    return mathlib::clamp(cell, 0, cellsY - 1);
+}
+
+template <typename F>
+void PointSpatialIndex::forEachPointInCells(int minX, int minY, int maxX, int maxY, F f) const {
+    for (int y = minY; y <= maxY; ++y) {
+        // Cells in a row are contiguous so a whole row span is one range of points
+        const auto first = cellStarts[y * cellsX + minX];
+        const auto last = cellStarts[y * cellsX + maxX + 1];
+        for (int i = first; i < last; ++i) f(i);
+    }
+}
+
+vector<int> PointSpatialIndex::queryRect(const Vec2f& minCorner, const Vec2f& maxCorner) const {
+    auto res = vector<int>{};
+    if (empty() || maxCorner.x() < boundsMin.x() || maxCorner.y() < boundsMin.y() ||
+        minCorner.x() > boundsMax.x() || minCorner.y() > boundsMax.y())
+        return res;
+    forEachPointInCells(cellX(minCorner.x()), cellY(minCorner.y()), cellX(maxCorner.x()),
+                        cellY(maxCorner.y()), [&](int i) {
+                            const auto& p = sortedPoints[i];
+                            if (p.x() >= minCorner.x() && p.x() <= maxCorner.x() &&
+                                p.y() >= minCorner.y() && p.y() <= maxCorner.y())
+                                res.push_back(sortedIndices[i]);
+                        });
+    sort(begin(res), end(res));
+    return res;
+}
+
+vector<int> PointSpatialIndex::queryRadius(const Vec2f& centre, float radius) const {
+    auto res = vector<int>{};
+    if (empty() || radius < 0.0f) return res;
+    const auto r = Vec2f{radius, radius};
+    const auto minCorner = centre - r;
+    const auto maxCorner = centre + r;
+    if (maxCorner.x() < boundsMin.x() || maxCorner.y() < boundsMin.y() ||
+        minCorner.x() > boundsMax.x() || minCorner.y() > boundsMax.y())
+        return res;
+    const auto radiusSq = radius * radius;
+    forEachPointInCells(cellX(minCorner.x()), cellY(minCorner.y()), cellX(maxCorner.x()),
+                        cellY(maxCorner.y()), [&](int i) {
+                            const auto d = sortedPoints[i] - centre;
+                            if (d.x() * d.x() + d.y() * d.y() <= radiusSq)
+                                res.push_back(sortedIndices[i]);
+                        });
+    sort(begin(res), end(res));
+    return res;
+}
+
+vector<int> PointSpatialIndex::queryNearest(const Vec2f& centre, int k) const {
+    auto res = vector<int>{};
+    if (empty() || k <= 0) return res;
+    k = min(k, to<int>(size()));
+
+    // Search rings of cells of increasing Chebyshev distance around the cell containing centre,
+    // keeping the k best candidates in a max heap. Any cell on ring r is at least (r - 1) cells
+    // away from centre so we can stop once that bound exceeds the current kth best distance.
+    using Candidate = pair<float, int>;
+    auto best = priority_queue<Candidate>{};
+    const auto consider = [&](int i) {
+        const auto d = sortedPoints[i] - centre;
+        const auto distSq = d.x() * d.x() + d.y() * d.y();
+        if (to<int>(best.size()) < k) {
+            best.emplace(distSq, i);
+        } else if (distSq < best.top().first) {
+            best.pop();
+            best.emplace(distSq, i);
+        }
+    };
+    const auto cx = cellX(centre.x());
+    const auto cy = cellY(centre.y());
+    const auto minCellSize = min(cellSize.x(), cellSize.y());
+    const auto maxRing = max(cellsX, cellsY);
+    for (int ring = 0; ring <= maxRing; ++ring) {
+        if (to<int>(best.size()) == k) {
+            const auto ringDist = (ring - 1) * minCellSize;
+            if (ringDist > 0.0f && ringDist * ringDist > best.top().first) break;
+        }
+        const auto minX = cx - ring, maxX = cx + ring;
+        const auto minY = cy - ring, maxY = cy + ring;
+        for (int y = max(minY, 0); y <= min(maxY, cellsY - 1); ++y) {
+            if (y == minY || y == maxY) {
+                // Top and bottom rows of the ring are full spans
+                forEachPointInCells(max(minX, 0), y, min(maxX, cellsX - 1), y, consider);
+            } else {
+                // Other rows only contribute their leftmost and rightmost cells
+                if (minX >= 0) forEachPointInCells(minX, y, minX, y, consider);
+                if (maxX < cellsX && ring > 0) forEachPointInCells(maxX, y, maxX, y, consider);
+            }
+        }
+    }
+
+    res.resize(best.size());
+    for (auto it = rbegin(res); it != rend(res); ++it) {
+        *it = sortedIndices[best.top().second];
+        best.pop();
+    }
+    return res;
+}
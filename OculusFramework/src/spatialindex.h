@@ -0,0 +1,51 @@
+#pragma once
+
+#include "vector.h"
+
+#pragma warning(push)
+#pragma warning(disable : 4245)
+#include <array_view.h>
+#pragma warning(pop)
+
+#include <vector>
+
+// Static spatial index over a set of 2D points (e.g. the lat/long positions of topographic
+// features). The index is a uniform grid sized so each cell holds a handful of points on average
+// with the points stored sorted by cell so each cell is a contiguous range (CSR layout). It is
+// built once at load time and is immutable afterwards so it is safe to query from multiple threads.
+//
+// All queries return indices into the array of points the index was built from. Distances are
+// Euclidean in whatever 2D space the points are in.
+class PointSpatialIndex {
+public:
+    PointSpatialIndex() = default;
+    explicit PointSpatialIndex(gsl::array_view<const mathlib::Vec2f> points,
+                               int targetPointsPerCell = 8);
+
+    // All points p with minCorner <= p <= maxCorner, in ascending index order
+    std::vector<int> queryRect(const mathlib::Vec2f& minCorner,
+                               const mathlib::Vec2f& maxCorner) const;
+    // All points within radius of centre, in ascending index order
+    std::vector<int> queryRadius(const mathlib::Vec2f& centre, float radius) const;
+    // Up to k points nearest to centre, nearest first
+    std::vector<int> queryNearest(const mathlib::Vec2f& centre, int k) const;
+
+    auto size() const { return sortedPoints.size(); }
+    bool empty() const { return sortedPoints.empty(); }
+
+private:
+    int cellX(float x) const;
+    int cellY(float y) const;
+    template <typename F>
+    void forEachPointInCells(int minX, int minY, int maxX, int maxY, F f) const;
+
+    std::vector<mathlib::Vec2f> sortedPoints;  // points ordered by cell
+    std::vector<int> sortedIndices;  // original index of each entry in sortedPoints
+    std::vector<int> cellStarts;     // cellsX * cellsY + 1 offsets into sortedPoints
+    mathlib::Vec2f boundsMin{0.0f};
+    mathlib::Vec2f boundsMax{0.0f};
+    mathlib::Vec2f invCellSize{0.0f};
+    mathlib::Vec2f cellSize{0.0f};
+    int cellsX = 0;
+    int cellsY = 0;
+};
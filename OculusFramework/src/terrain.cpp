@@ -1,8 +1,15 @@
 #include "terrain.h"
 
-#include "d2dhelper.h"
+#include "clipping.h"
+#include "contours.h"
 #include "d3dhelper.h"
+#include "dbfcolumns.h"
+#include "mappedshapefile.h"
+#include "overlaybake.h"
 #include "pipelinestateobject.h"
+#include "simplify.h"
+#include "threadpool.h"
+#include "vectorlayer.h"
 
 #include "DDSTextureLoader.h"
 
@@ -29,7 +36,9 @@
 #include "../commonstructs.hlsli"
 
 #include <algorithm>
+#include <array>
 #include <fstream>
+#include <future>
 #include <string>
 #include <sstream>
 #include <tuple>
@@ -78,9 +87,33 @@ public:
             throw runtime_error{"Unable to read geotiff definition"};
         assert(gtifDefinition.Model == ModelTypeGeographic);
 
+        // The model is geographic so lat/long to pixel is affine. Cache it so per vertex
+        // conversions don't go through libgeotiff, which also makes them safe to do from worker
+        // threads.
+        const auto pcsToImage = [this](double latitude, double longitude) {
+            if (!GTIFPCSToImage(gtif.get(), &longitude, &latitude))
+                throw runtime_error{"Error converting lat/long to pixel coordinates."};
+            return make_pair(longitude, latitude);
+        };
+        const auto origin = pixXYToLatLong(0, 0);
+        latLongOrigin = {origin.x(), origin.y()};
+        pixOrigin = pcsToImage(latLongOrigin.first, latLongOrigin.second);
+        const auto pixLat = pcsToImage(latLongOrigin.first + 1.0, latLongOrigin.second);
+        const auto pixLong = pcsToImage(latLongOrigin.first, latLongOrigin.second + 1.0);
+        pixPerLat = {pixLat.first - pixOrigin.first, pixLat.second - pixOrigin.second};
+        pixPerLong = {pixLong.first - pixOrigin.first, pixLong.second - pixOrigin.second};
+
         const auto topLeft = topLeftLatLong();
         const auto topRight = pixXYToLatLong(tifWidth, 0);
         const auto bottomLeft = pixXYToLatLong(0, tifHeight);
+        // All four corners since the raster needn't be axis aligned in lat/long
+        const Vec2f corners[] = {topLeft, topRight, bottomLeft,
+                                 pixXYToLatLong(tifWidth, tifHeight)};
+        bounds = make_pair(corners[0], corners[0]);
+        for (const auto& c : corners) {
+            bounds.first = {min(bounds.first.x(), c.x()), min(bounds.first.y(), c.y())};
+            bounds.second = {max(bounds.second.x(), c.x()), max(bounds.second.y(), c.y())};
+        }
         widthMeters = latLongDist(topLeft, topRight);
         heightMeters = latLongDist(topLeft, bottomLeft);
     }
@@ -106,10 +139,23 @@ public:
         return {static_cast<float>(latitude), static_cast<float>(longitude)};
     }
     Vec2f topLeftLatLong() const { return pixXYToLatLong(0, 0); }
+    // Min and max lat/long corners of the area covered by the elevation data, cached so it is
+    // safe to call from worker threads
+    pair<Vec2f, Vec2f> latLongBounds() const { return bounds; }
     Vec2f latLongToPixXY(double latitude, double longitude) const {
-        if (!GTIFPCSToImage(gtif.get(), &longitude, &latitude))
-            throw runtime_error{"Error converting pixel coordinates to lat/long."};
-        return {to<float>(longitude), to<float>(latitude)};
+        const auto dLat = latitude - latLongOrigin.first;
+        const auto dLong = longitude - latLongOrigin.second;
+        return {to<float>(pixOrigin.first + pixPerLat.first * dLat + pixPerLong.first * dLong),
+                to<float>(pixOrigin.second + pixPerLat.second * dLat + pixPerLong.second * dLong)};
+    }
+    // Inverse of latLongToPixXY(), likewise safe to call from worker threads
+    Vec2f pixXYToLatLong(const Vec2f& pix) const {
+        const auto dx = pix.x() - pixOrigin.first;
+        const auto dy = pix.y() - pixOrigin.second;
+        const auto det = pixPerLat.first * pixPerLong.second - pixPerLong.first * pixPerLat.second;
+        const auto dLat = (dx * pixPerLong.second - pixPerLong.first * dy) / det;
+        const auto dLong = (pixPerLat.first * dy - dx * pixPerLat.second) / det;
+        return {to<float>(latLongOrigin.first + dLat), to<float>(latLongOrigin.second + dLong)};
     }
 
     float latLongDist(const Vec2f& a, const Vec2f& b) const {
@@ -160,6 +206,12 @@ private:
     unique_ptr<TIFF, void (*)(TIFF*)> tif{nullptr, XTIFFClose};
     unique_ptr<GTIF, void (*)(GTIF*)> gtif{nullptr, GTIFFree};
     GTIFDefn gtifDefinition = {};
+    // Affine lat/long to pixel transform, the pixel terms are (x, y) pairs
+    pair<double, double> latLongOrigin;
+    pair<double, double> pixOrigin;
+    pair<double, double> pixPerLat;
+    pair<double, double> pixPerLong;
+    pair<Vec2f, Vec2f> bounds;
 };
 
 void HeightField::AddVertices(DirectX11& dx11, ID3D11Device* device, ID3D11DeviceContext* context,
@@ -175,48 +227,67 @@ void HeightField::AddVertices(DirectX11& dx11, ID3D11Device* device, ID3D11Devic
                               static_cast<UINT>(geoTiff.getTiffHeight())}
                     .mipLevels(1),
         {heights.data(), geoTiff.getTiffWidth() * sizeof(heights[0])});
-    midElevationOffset = translationMat4f(
-        {0.0f, -0.5f * (geoTiff.getMaxElevationMeters() - geoTiff.getMinElevationMeters()), 0.0f});
-    terrainParameters.minMaxTerrainHeight =
-        Vec2f{geoTiff.getMinElevationMeters(), geoTiff.getMaxElevationMeters()};
-    terrainParameters.terrainWidthHeightMeters =
-        Vec2f{geoTiff.getWidthMeters(), geoTiff.getHeightMeters()};
-
-    generateNormalMap(device, geoTiff);
-    generateHeightFieldGeometry(device, geoTiff);
-
-    PipelineStateObjectDesc desc;
-    desc.vertexShader = "terrainvs.hlsl";
-    desc.pixelShader = "terrainps.hlsl";
-    desc.inputElementDescs = HeightFieldVertexInputElementDescs;
-    pipelineStateObject = pipelineStateObjectManager.get(desc);
-
-    PipelineStateObjectDesc wireframeDesc;
-    wireframeDesc.depthStencilState = DepthStencilDesc{}.depthFunc(D3D11_COMPARISON_LESS_EQUAL);
-    wireframeDesc.rasterizerState = RasterizerDesc{}.fillMode(D3D11_FILL_WIREFRAME).depthBias(4);
-    wireframeDesc.vertexShader = "terrainvs.hlsl";
-    wireframeDesc.pixelShader = "terrainwireframeps.hlsl";
-    wireframeDesc.inputElementDescs = HeightFieldVertexInputElementDescs;
-    wireframePipelineState = pipelineStateObjectManager.get(wireframeDesc);
-
-    objectConstantBuffer = CreateBuffer(
-        device, BufferDesc{roundUpConstantBufferSize(sizeof(Object)), D3D11_BIND_CONSTANT_BUFFER,
-                           D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE});
-
-    loadTopographicFeaturesShapeFile();
-    generateLabels(geoTiff, device, context, pipelineStateObjectManager, dx11);
-
-    loadCreeksShapeFile(geoTiff);
-    generateCreeksTexture(dx11);
-
-    loadRoadsShapeFile(geoTiff);
-    generateRoadsTexture(dx11);
+    // The vector layers are independent files so load them concurrently with each other and with
+    // the heightfield processing below. Labels and overlay textures need the D3D context so are
+    // generated on this thread after the loads have joined. The loads write disjoint members and
+    // only use the thread safe parts of geoTiff.
+    auto& pool = ThreadPool::global();
+    auto layerLoads = vector<future<void>>{};
+    layerLoads.reserve(6);
+    layerLoads.push_back(pool.submit([this] { loadTopographicFeaturesShapeFile(); }));
+    layerLoads.push_back(pool.submit([this, &geoTiff] { loadCreeksShapeFile(geoTiff); }));
+    layerLoads.push_back(pool.submit([this, &geoTiff] { loadRoadsShapeFile(geoTiff); }));
+    layerLoads.push_back(pool.submit([this, &geoTiff] { loadLakesShapeFile(geoTiff); }));
+    layerLoads.push_back(pool.submit([this, &geoTiff] { loadGlaciersShapeFile(geoTiff); }));
+    layerLoads.push_back(pool.submit([this, &geoTiff] { generateContours(geoTiff); }));
+    // Wait for every load before rethrowing any failure, they reference geoTiff and this. Futures
+    // from the pool don't block on destruction so this must also run when the work below throws.
+    const auto waitForLoads = [&layerLoads] {
+        for (auto& load : layerLoads) load.wait();
+    };
 
-    loadLakesShapeFile(geoTiff);
-    generateLakesTexture(dx11);
+    try {
+        midElevationOffset = translationMat4f(
+            {0.0f, -0.5f * (geoTiff.getMaxElevationMeters() - geoTiff.getMinElevationMeters()),
+             0.0f});
+        terrainParameters.minMaxTerrainHeight =
+            Vec2f{geoTiff.getMinElevationMeters(), geoTiff.getMaxElevationMeters()};
+        terrainParameters.terrainWidthHeightMeters =
+            Vec2f{geoTiff.getWidthMeters(), geoTiff.getHeightMeters()};
+        gridStepMeters = Vec2f{geoTiff.getGridStepMetersX(), geoTiff.getGridStepMetersY()};
+
+        generateNormalMap(device, geoTiff);
+        generateHeightFieldGeometry(device, geoTiff);
+
+        PipelineStateObjectDesc desc;
+        desc.vertexShader = "terrainvs.hlsl";
+        desc.pixelShader = "terrainps.hlsl";
+        desc.inputElementDescs = HeightFieldVertexInputElementDescs;
+        pipelineStateObject = pipelineStateObjectManager.get(desc);
+
+        PipelineStateObjectDesc wireframeDesc;
+        wireframeDesc.depthStencilState =
+            DepthStencilDesc{}.depthFunc(D3D11_COMPARISON_LESS_EQUAL);
+        wireframeDesc.rasterizerState =
+            RasterizerDesc{}.fillMode(D3D11_FILL_WIREFRAME).depthBias(4);
+        wireframeDesc.vertexShader = "terrainvs.hlsl";
+        wireframeDesc.pixelShader = "terrainwireframeps.hlsl";
+        wireframeDesc.inputElementDescs = HeightFieldVertexInputElementDescs;
+        wireframePipelineState = pipelineStateObjectManager.get(wireframeDesc);
+
+        objectConstantBuffer =
+            CreateBuffer(device, BufferDesc{roundUpConstantBufferSize(sizeof(Object)),
+                                            D3D11_BIND_CONSTANT_BUFFER, D3D11_USAGE_DYNAMIC,
+                                            D3D11_CPU_ACCESS_WRITE});
+    } catch (...) {
+        waitForLoads();
+        throw;
+    }
+    waitForLoads();
+    for (auto& load : layerLoads) load.get();
 
-    loadGlaciersShapeFile(geoTiff);
-    generateGlaciersTexture(dx11);
+    generateLabels(geoTiff, device, context, pipelineStateObjectManager, dx11);
+    generateOverlay(device);
 
     terrainParametersConstantBuffer =
         CreateBuffer(device, BufferDesc{roundUpConstantBufferSize(sizeof(TerrainParameters)),
@@ -225,7 +296,8 @@ void HeightField::AddVertices(DirectX11& dx11, ID3D11Device* device, ID3D11Devic
                      "HeightField::terrainParametersConstantBuffer");
 }
 
-void HeightField::Render(DirectX11& dx11, ID3D11DeviceContext* context) {
+void HeightField::Render(DirectX11& dx11, ID3D11DeviceContext* context, const Vec3f& eye) {
+    updateOverlay(context, eye);
     dx11.applyState(*context, *pipelineStateObject.get());
 
     Object object;
@@ -249,7 +321,8 @@ void HeightField::Render(DirectX11& dx11, ID3D11DeviceContext* context) {
     VSSetShaderResources(context, 0, {heightsSRV.Get()});
     PSSetConstantBuffers(context, objectConstantBufferOffset, { objectConstantBuffer.Get() });
     PSSetShaderResources(context, materialSRVOffset,
-                         {heightsSRV.Get(), normalsSRV.Get(), creeksSrv.Get(), lakesAndGlaciersSrv.Get()});
+                         {heightsSRV.Get(), normalsSRV.Get(), overlay->atlasSrv(),
+                          overlay->indirectionSrv(), overlay->distanceAtlasSrv()});
     uint32_t chunkIndex = 0;
     for (const auto& vertexBuffer : VertexBuffers) {
         terrainParameters.chunkInfo.w() = chunkIndex;
@@ -274,12 +347,14 @@ void HeightField::Render(DirectX11& dx11, ID3D11DeviceContext* context) {
 
     if (renderLabels) {
         dx11.applyState(*context, *labelsPipelineStateObject.get());
-        context->IASetIndexBuffer(labelsIndexBuffer.Get(), DXGI_FORMAT_R16_UINT, 0);
-        IASetVertexBuffers(context, 0, {labelsVertexBuffer.Get()}, {to<UINT>(sizeof(LabelVertex))});
+        context->IASetIndexBuffer(labelQuadIndexBuffer.Get(), DXGI_FORMAT_R16_UINT, 0);
+        IASetVertexBuffers(context, 0, {labelQuadVertexBuffer.Get(), labelInstanceBuffer.Get()},
+                           {to<UINT>(sizeof(LabelQuadVertex)), to<UINT>(sizeof(LabelInstance))});
         for (auto i = 0u; i < topographicFeatureLabels.size(); ++i) {
-            if (displayedConciscodes[topographicFeatures[i].conciscode]) {
+            const auto& feature = topographicFeatures[labelFeatureIndices[i]];
+            if (displayedConciscodes[feature.conciscode]) {
                 PSSetShaderResources(context, materialSRVOffset, { topographicFeatureLabels[i].srv() });
-                context->DrawIndexed(6, i * 6, 0);
+                context->DrawIndexedInstanced(6, 1, 0, 0, i);
             }
         }
 
@@ -292,85 +367,78 @@ void HeightField::Render(DirectX11& dx11, ID3D11DeviceContext* context) {
 
 class ShapeFile {
 public:
-    struct DBFFieldInfo {
-        int index = 0;
-        DBFFieldType type = FTInvalid;
-        char name[12] = {};
-        int width = 0;
-        int decimals = 0;
-    };
+    ShapeFile(const char* filename, const vector<string>& stringAttributes,
+              const vector<string>& doubleAttributes)
+        : geometry{filename}, attributes{filename, stringAttributes, doubleAttributes} {
+        if (attributes.size() != geometry.size())
+            throw runtime_error{"Shapefile geometry and attribute record counts differ."};
+    }
 
-    ShapeFile(const char* filename) {
-        shapeHandle = {SHPOpen(filename, "rb"), SHPClose};
-        if (!shapeHandle) throw runtime_error{"Failed to open shapefile."};
-        auto numEntities = 0;
-        auto shapeType = 0;
-        auto minBounds = Vector<double, 4>{};
-        auto maxBounds = Vector<double, 4>{};
-        SHPGetInfo(shapeHandle.get(), &numEntities, &shapeType, minBounds.data(), maxBounds.data());
-        shapes.reserve(numEntities);
-        for (int i = 0; i < numEntities; ++i) {
-            shapes.emplace_back(SHPReadObject(shapeHandle.get(), i), SHPDestroyObject);
-        }
+    // Look columns up once outside loops over shapes and index them by shapeId
+    const auto& stringColumn(const char* fieldName) const {
+        return attributes.stringColumn(fieldName);
+    }
+    const auto& doubleColumn(const char* fieldName) const {
+        return attributes.doubleColumn(fieldName);
+    }
 
-        dbfHandle = {DBFOpen(filename, "rb"), DBFClose};
-        const auto dbfFieldCount = DBFGetFieldCount(dbfHandle.get());
-        const auto dbfRecordCount = DBFGetRecordCount(dbfHandle.get());
-        assert(dbfRecordCount == numEntities);
-        for (int i = 0; i < dbfFieldCount; ++i) {
-            auto fieldInfo = ShapeFile::DBFFieldInfo{};
-            fieldInfo.type = DBFGetFieldInfo(dbfHandle.get(), i, fieldInfo.name, &fieldInfo.width,
-                                             &fieldInfo.decimals);
-            fieldInfos[fieldInfo.name] = fieldInfo;
+    auto size() const { return geometry.size(); }
+
+    // Stream the shapes in file order, calling f(record, latLongs) for each. latLongs is a view
+    // of a buffer reused across shapes so it is only valid for the duration of the call and peak
+    // memory is bounded by the largest shape rather than the whole layer.
+    template <typename F>
+    void forEachShape(F f) const {
+        auto latLongs = vector<Vec2f>{};
+        for (const auto& record : geometry) {
+            latLongs.resize(record.numPoints());
+            record.decodeLatLongs(gsl::as_array_view(latLongs));
+            f(record, const_array_view(latLongs));
         }
     }
 
-    auto readStringAttribute(int shapeId, const char* fieldName) {
-        assert(to<size_t>(shapeId) < shapes.size());
-        assert(fieldInfos.find(fieldName) != end(fieldInfos) &&
-               fieldInfos[fieldName].type == FTString);
-        const auto fieldIndex = DBFGetFieldIndex(dbfHandle.get(), fieldName);
-        const auto fieldChars = DBFReadStringAttribute(dbfHandle.get(), shapeId, fieldIndex);
-        return string{fieldChars};
-    };
-
-    auto readDoubleAttribute(int shapeId, const char* fieldName) {
-        assert(to<size_t>(shapeId) < shapes.size());
-        assert(fieldInfos.find(fieldName) != end(fieldInfos) &&
-               fieldInfos[fieldName].type == FTDouble);
-        const auto fieldIndex = DBFGetFieldIndex(dbfHandle.get(), fieldName);
-        const auto fieldValue = DBFReadDoubleAttribute(dbfHandle.get(), shapeId, fieldIndex);
-        return fieldValue;
+    // Ids of the shapes whose bounding boxes overlap the (lat, long) bounds, for loaders that
+    // process shapes in parallel and access them with record()
+    auto shapesInBounds(const pair<Vec2f, Vec2f>& bounds) const {
+        return geometry.recordsInLatLongRect(bounds.first, bounds.second);
     }
-
-    const auto& getShapes() { return shapes; }
+    auto record(int shapeId) const { return geometry.record(shapeId); }
 
 private:
-    unique_ptr<SHPInfo, void (*)(SHPHandle)> shapeHandle = {nullptr, SHPClose};
-    using ShpObjectPtr = unique_ptr<SHPObject, void(*)(SHPObject*)>;
-    vector<ShpObjectPtr> shapes;
-    unique_ptr<DBFInfo, void (*)(DBFHandle)> dbfHandle{nullptr, DBFClose};
-    unordered_map<string, DBFFieldInfo> fieldInfos;
+    MappedShapeFile geometry;
+    DbfColumns attributes;
 };
 
 void HeightField::loadTopographicFeaturesShapeFile() {
-    auto shapeFile = ShapeFile{R"(data\canvec_150528_015119_shp\to_1580009_0.shp)"};
-
-    for (const auto& shape : shapeFile.getShapes()) {
-        const auto nameen = shapeFile.readStringAttribute(shape->nShapeId, "nameen");
-        const auto longitude = float(*shape->padfX);
-        const auto latitude = float(*shape->padfY);
-        const auto conciscode = to<int>(shapeFile.readDoubleAttribute(shape->nShapeId, "conciscode"));
+    const auto shapeFile = ShapeFile{R"(data\canvec_150528_015119_shp\to_1580009_0.shp)",
+                                     {"nameen"}, {"conciscode"}};
+
+    const auto& nameens = shapeFile.stringColumn("nameen");
+    const auto& conciscodes = shapeFile.doubleColumn("conciscode");
+    topographicFeatures.reserve(shapeFile.size());
+    shapeFile.forEachShape([&](const auto& shape, const auto& latLongs) {
+        assert(latLongs.size() == 1);
+        const auto& nameen = nameens[shape.shapeId()];
+        const auto conciscode = to<int>(conciscodes[shape.shapeId()]);
         displayedConciscodes[conciscode] = true;
-        topographicFeatures.push_back({Vec2f{latitude, longitude}, nameen, conciscode});
-    }
+        topographicFeatures.push_back({latLongs[0], nameen, conciscode});
+    });
+
+    auto latLongs = vector<Vec2f>(topographicFeatures.size());
+    transform(begin(topographicFeatures), end(topographicFeatures), begin(latLongs),
+              [](const auto& feature) { return feature.latLong; });
+    topographicFeatureIndex = PointSpatialIndex{const_array_view(latLongs)};
 }
 
 void HeightField::generateLabels(const GeoTiff& geoTiff, ID3D11Device* device,
                                  ID3D11DeviceContext* context,
                                  PipelineStateObjectManager& pipelineStateObjectManager,
                                  DirectX11& dx11) {
-    for (const auto& feature : topographicFeatures) {
+    // Only generate labels for features that lie on the terrain
+    const auto bounds = geoTiff.latLongBounds();
+    labelFeatureIndices = topographicFeatureIndex.queryRect(bounds.first, bounds.second);
+    for (const auto featureIndex : labelFeatureIndices) {
+        const auto& feature = topographicFeatures[featureIndex];
         topographicFeatureLabels.emplace_back(device, context, dx11.d2d1Factory1.Get(),
                                               dx11.d2d1DeviceContext.Get(), feature.label.c_str());
         const auto& label = topographicFeatureLabels.back();
@@ -402,28 +470,26 @@ void HeightField::generateLabels(const GeoTiff& geoTiff, ID3D11Device* device,
         labelFlagpoleVertices.push_back({Vec3f{labelX, labelHeight, labelZ}});
         const auto labelPos = Vec3f{labelX, labelHeight, labelZ};
         const auto labelColor = 0xffffffffu;
-        const auto baseVertexIdx = uint16_t(labelsVertices.size());
-        labelsVertices.push_back(
-            {labelPos, labelColor, Vec2f{1.0f, 1.0f}, Vec2f{0.5f * labelSize.x(), 0.0f}});
-        labelsVertices.push_back(
-            {labelPos, labelColor, Vec2f{0.0f, 1.0f}, Vec2f{-0.5f * labelSize.x(), 0.0f}});
-        labelsVertices.push_back(
-            {labelPos, labelColor, Vec2f{0.0f, 0.0f}, Vec2f{-0.5f * labelSize.x(), labelSize.y()}});
-        labelsVertices.push_back(
-            {labelPos, labelColor, Vec2f{1.0f, 0.0f}, Vec2f{0.5f * labelSize.x(), labelSize.y()}});
-        uint16_t indices[] = {0, 1, 2, 0, 2, 3};
-        for (auto& idx : indices) idx += baseVertexIdx;
-        labelsIndices.insert(end(labelsIndices), begin(indices), end(indices));
+        const auto uvs = label.getUvs();
+        labelInstances.push_back(
+            {labelPos, labelColor, labelSize,
+             Vec4f{uvs.first.x(), uvs.first.y(), uvs.second.x(), uvs.second.y()}});
     }
-    labelsVertexBuffer = CreateVertexBuffer(device, const_array_view(labelsVertices));
-    labelsIndexBuffer = CreateIndexBuffer(device, const_array_view(labelsIndices));
+
+    // Corners of the shared label quad, x across the label and y up from the anchor
+    const auto quadVertices = vector<LabelQuadVertex>{
+        {Vec2f{1.0f, 0.0f}}, {Vec2f{0.0f, 0.0f}}, {Vec2f{0.0f, 1.0f}}, {Vec2f{1.0f, 1.0f}}};
+    const auto quadIndices = vector<uint16_t>{0, 1, 2, 0, 2, 3};
+    labelQuadVertexBuffer = CreateVertexBuffer(device, const_array_view(quadVertices));
+    labelQuadIndexBuffer = CreateIndexBuffer(device, const_array_view(quadIndices));
+    labelInstanceBuffer = CreateVertexBuffer(device, const_array_view(labelInstances));
     labelFlagpolesVertexBuffer =
         CreateVertexBuffer(device, const_array_view(labelFlagpoleVertices));
 
     PipelineStateObjectDesc labelsDesc;
     labelsDesc.vertexShader = "labelvs.hlsl";
     labelsDesc.pixelShader = "labelps.hlsl";
-    labelsDesc.inputElementDescs = HeightFieldLabelVertexInputElementDescs;
+    labelsDesc.inputElementDescs = HeightFieldLabelInputElementDescs;
     labelsPipelineStateObject = pipelineStateObjectManager.get(labelsDesc);
 
     PipelineStateObjectDesc labelFlagpolesDesc;
@@ -434,64 +500,147 @@ void HeightField::generateLabels(const GeoTiff& geoTiff, ID3D11Device* device,
     labelFlagpolePso = pipelineStateObjectManager.get(labelFlagpolesDesc);
 }
 
-void HeightField::loadCreeksShapeFile(const GeoTiff& geoTiff) {
-    creeks =
-        loadArcShapeFile(R"(data\canvec_150528_015119_shp\hd_1470009_1.shp)", geoTiff, {"nameen"});
+// Overlapping CanVec extracts covering the terrain. Vector layers are loaded from each of them
+// and merged so features in both are only rendered once.
+static const char* const canvecExtracts[] = {R"(data\canvec_150528_015119_shp\)",
+                                             R"(data\canvec_150506_001104_shp\)"};
+
+template <typename LoadLayer>
+static VectorLayer loadFromAllExtracts(const char* layerFilename, LoadLayer loadLayer) {
+    auto layers = vector<VectorLayer>{};
+    for (const auto extract : canvecExtracts)
+        layers.push_back(loadLayer((string{extract} + layerFilename).c_str()));
+    return mergeVectorLayers(layers);
 }
 
-void HeightField::generateCreeksTexture(DirectX11& dx11) {
-    tie(creeksTex, creeksSrv) = CreateTexture2DAndShaderResourceView(
-        dx11.Device.Get(), Texture2DDesc{DXGI_FORMAT_R8G8B8A8_UNORM_SRGB,
-                                         to<UINT>(heightFieldWidth), to<UINT>(heightFieldHeight)}
-                               .bindFlags(D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET)
-                               .miscFlags(D3D11_RESOURCE_MISC_GENERATE_MIPS),
-        "HeightField::creeks texture");
-    renderArcsToTexture(creeks, creeksTex.Get(), dx11, D2D1::ColorF(D2D1::ColorF::Red));
-    dx11.Context->GenerateMips(creeksSrv.Get());
+void HeightField::loadCreeksShapeFile(const GeoTiff& geoTiff) {
+    creeks = loadFromAllExtracts("hd_1470009_1.shp", [&geoTiff](const char* filename) {
+        return loadArcShapeFile(filename, geoTiff, {"nameen"}, true);
+    });
 }
 
 void HeightField::loadRoadsShapeFile(const GeoTiff& geoTiff) {
-    roads = loadArcShapeFile(R"(data\canvec_150528_015119_shp\tr_1760009_1.shp)", geoTiff,
-                             {"r_stname"});
+    roads = loadFromAllExtracts("tr_1760009_1.shp", [&geoTiff](const char* filename) {
+        return loadArcShapeFile(filename, geoTiff, {"r_stname"}, true);
+    });
 }
 
-void HeightField::generateRoadsTexture(DirectX11& dx11) {
-    renderArcsToTexture(roads, creeksTex.Get(), dx11, D2D1::ColorF(D2D1::ColorF::Lime));
-    dx11.Context->GenerateMips(creeksSrv.Get());
+void HeightField::loadLakesShapeFile(const GeoTiff& geoTiff) {
+    lakes = loadFromAllExtracts("hd_1480009_2.shp", [&geoTiff](const char* filename) {
+        return loadPolygonShapeFile(filename, geoTiff, {"laknameen", "rivnameen"}, true);
+    });
 }
 
-void HeightField::generateLakesTexture(DirectX11& dx11) {
-    tie(lakesAndGlaciersTex, lakesAndGlaciersSrv) = CreateTexture2DAndShaderResourceView(
-        dx11.Device.Get(), Texture2DDesc{DXGI_FORMAT_B8G8R8A8_UNORM_SRGB,
-                                         to<UINT>(heightFieldWidth), to<UINT>(heightFieldHeight)}
-                               .bindFlags(D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET)
-                               .miscFlags(D3D11_RESOURCE_MISC_GENERATE_MIPS),
-        "HeightField::lakes texture");
-    renderLakesTexture(dx11);
+void HeightField::loadGlaciersShapeFile(const GeoTiff& geoTiff) {
+    glaciers = loadFromAllExtracts("hd_1140009_2.shp", [&geoTiff](const char* filename) {
+        return loadPolygonShapeFile(filename, geoTiff, {}, true);
+    });
 }
 
-void HeightField::renderLakesTexture(DirectX11& dx11) {
-    renderPolygonsToTexture(lakes, lakesAndGlaciersTex.Get(), dx11, D2D1::ColorF(D2D1::ColorF::Red),
-                            D2D1::ColorF(D2D1::ColorF::Lime));
-    dx11.Context->GenerateMips(lakesAndGlaciersSrv.Get());
+// Height difference between contour lines
+static const auto contourIntervalMeters = 100.0f;
+
+void HeightField::generateContours(const GeoTiff& geoTiff) {
+    const auto pixToLatLong = [&geoTiff](const Vec2f& pix) { return geoTiff.pixXYToLatLong(pix); };
+    contours = extractContours(gsl::as_array_view(geoTiff.getHeights()), geoTiff.getTiffWidth(),
+                               geoTiff.getTiffHeight(), contourIntervalMeters, pixToLatLong);
 }
 
-void HeightField::loadLakesShapeFile(const GeoTiff& geoTiff) {
-    lakes = loadPolygonShapeFile(R"(data\canvec_150528_015119_shp\hd_1480009_2.shp)", geoTiff,
-                                 {"laknameen", "rivnameen"});
+// The finest overlay level has this many texels per heightfield pixel. The atlas holds 8x8 tiles,
+// 11 MB of masks and 11 MB of distance fields with their mips against the 270 MB or so the whole
+// overlay would take at this resolution.
+static const auto overlayMaxScale = 16.0f;
+static const auto overlayAtlasPages = 8;
+// Screen pixels per radian of view used to choose overlay tile levels, roughly a Rift eye buffer
+static const auto overlayPixelsPerRadian = 800.0f;
+// Widest creek or road the GUI allows in heightfield pixels, the overlay distance fields cover
+// half of it
+static const auto overlayMaxArcWidth = 8.0f;
+
+void HeightField::generateOverlay(ID3D11Device* device) {
+    // Lake outlines and contours are a few texels wide so a box filter would fade them out in the
+    // tile mips
+    const auto layerFilters = array<MipFilter, overlayMaskLayers>{
+        {MipFilter::average, MipFilter::preserveCoverage, MipFilter::average, MipFilter::average,
+         MipFilter::average, MipFilter::preserveCoverage, MipFilter::average,
+         MipFilter::average}};
+    overlay = make_unique<VirtualOverlay>(device, heightFieldWidth, heightFieldHeight,
+                                          overlayMaxScale, overlayAtlasPages, layerFilters,
+                                          0.5f * overlayMaxArcWidth, makeOverlayBaker());
+    terrainParameters.overlayParameters = overlay->shaderParameters();
+    terrainParameters.overlayDistanceParameters = overlay->distanceParameters();
 }
 
-void HeightField::generateGlaciersTexture(DirectX11& dx11) { renderGlaciersTexture(dx11); }
+VirtualOverlay::BakeTile HeightField::makeOverlayBaker() const {
+    // Each layer is a separate overlay mask layer for the terrain shader: lake outlines in 1, lakes
+    // in 2, glaciers in 3 and contours in 5. Layers after the lakes are stroked as coverage into a
+    // scratch image then maxed into their layer so they don't disturb the others. Creeks and roads
+    // are distance fields in r and g of distances so the shader can apply their widths. The
+    // layers are only read once loaded so this is safe on the pool threads.
+    return [this, layers = overlayLayers](OverlayLayerImages& images, RgbaImage& distances,
+                                          const Vec2f& origin, float scale, float maxDistance) {
+        // Widths are in heightfield pixels but lines are kept at least a texel wide
+        const auto lineWidth = [scale](float width) { return max(width * scale, 1.0f); };
+        const auto opaque = [](bool show, Rgba color) { return show ? color : Rgba{}; };
+        auto& image = images[0];
+        bakePolygonLayer(lakes, image, opaque(layers.lakeOutlines, Rgba{0, 255, 0, 255}),
+                         opaque(layers.lakes, Rgba{0, 0, 255, 255}), lineWidth(3.0f), scale,
+                         origin);
+        for (int y = 0; y < image.height(); ++y)
+            for (int x = 0; x < image.width(); ++x) image.row(y)[x].a = 0;
+
+        auto mask = RgbaImage{image.width(), image.height()};
+        const auto addMask = [&mask](RgbaImage& target, unsigned char Rgba::*channel) {
+            for (int y = 0; y < target.height(); ++y) {
+                for (int x = 0; x < target.width(); ++x) {
+                    auto& pixel = target.row(y)[x].*channel;
+                    pixel = max(pixel, mask.row(y)[x].a);
+                    mask.row(y)[x] = Rgba{};
+                }
+            }
+        };
+        const auto white = Rgba{255, 255, 255, 255};
+        if (layers.glaciers) {
+            bakePolygonLayer(glaciers, mask, white, white, lineWidth(3.0f), scale, origin);
+            addMask(images[0], &Rgba::a);
+        }
+        if (layers.contours) {
+            bakeArcLayer(contours, mask, white, lineWidth(1.0f), scale, origin);
+            addMask(images[1], &Rgba::g);
+        }
 
-void HeightField::renderGlaciersTexture(DirectX11& dx11) {
-    renderPolygonsToTexture(glaciers, lakesAndGlaciersTex.Get(), dx11,
-                            D2D1::ColorF(D2D1::ColorF::Blue), D2D1::ColorF(D2D1::ColorF::Blue));
-    dx11.Context->GenerateMips(lakesAndGlaciersSrv.Get());
+        const auto addDistances = [&distances, maxDistance, scale, &origin](
+            const VectorLayer& arcs, unsigned char Rgba::*channel) {
+            const auto field = bakeArcDistanceField(arcs, distances.width(), distances.height(),
+                                                    maxDistance, scale, origin);
+            for (int y = 0; y < distances.height(); ++y) {
+                const auto src = &field[size_t(y) * distances.width()];
+                for (int x = 0; x < distances.width(); ++x)
+                    distances.row(y)[x].*channel = uint8_t(src[x] / maxDistance * 255.0f + 0.5f);
+            }
+        };
+        if (layers.creeks) addDistances(creeks, &Rgba::r);
+        if (layers.roads) addDistances(roads, &Rgba::g);
+    };
 }
 
-void HeightField::loadGlaciersShapeFile(const GeoTiff& geoTiff) {
-    glaciers =
-        loadPolygonShapeFile(R"(data\canvec_150528_015119_shp\hd_1140009_2.shp)", geoTiff, {});
+void HeightField::updateOverlay(ID3D11DeviceContext* context, const Vec3f& eye) {
+    // Eye in object space by inverting GetMatrix()
+    const auto minMaxHeight = terrainParameters.minMaxTerrainHeight;
+    const auto objectEye =
+        Vec4f{eye, 1.0f} * translationMat4f(-Pos) *
+        Mat4FromQuat(QuaternionFromAxisAngle<float>(basisVector<Vec3f>(Y), -rotationAngle)) *
+        scaleMat4f(1.0f / scale) *
+        translationMat4f({0.0f, 0.5f * (minMaxHeight.y() - minMaxHeight.x()), 0.0f});
+    // Vertices are centered on the terrain at heightfield pixel centers, see
+    // generateHeightFieldGeometry()
+    const auto extent = terrainParameters.terrainWidthHeightMeters;
+    const auto eyePix = Vec2f{(objectEye.x() + 0.5f * extent.x()) / gridStepMeters.x() + 0.5f,
+                              (objectEye.z() + 0.5f * extent.y()) / gridStepMeters.y() + 0.5f};
+    const auto eyeHeight =
+        max({minMaxHeight.x() - objectEye.y(), 0.0f, objectEye.y() - minMaxHeight.y()}) /
+        gridStepMeters.x();
+    overlay->update(context, eyePix, eyeHeight, overlayPixelsPerRadian);
 }
 
 void HeightField::showGui() {
@@ -501,27 +650,25 @@ void HeightField::showGui() {
         ImGui::Checkbox("Show wireframe", &showWireframe);
         static bool showChunks = false;
         ImGui::Checkbox("Show chunks", &showChunks);
-        terrainParameters.showContoursChunks.y() = showChunks ? 1.0f : 0.0f;
+        terrainParameters.showChunks.x() = showChunks ? 1.0f : 0.0f;
         ImGui::SliderFloat("Scale", &scale, 1e-5f, 1e-3f, "scale = %.6f", 3.0f);
         ImGui::Checkbox("Show topographic feature labels", &renderLabels);
-        static bool showLakeOutlines = true;
-        ImGui::Checkbox("Show lake outlines", &showLakeOutlines);
-        terrainParameters.hydroLayerAlphas.x() = showLakeOutlines ? 1.0f : 0.0f;
-        static bool showLakes = true;
-        ImGui::Checkbox("Show lakes", &showLakes);
-        terrainParameters.hydroLayerAlphas.y() = showLakes ? 1.0f : 0.0f;
-        static bool showCreeks = true;
-        ImGui::Checkbox("Show creeks", &showCreeks);
-        terrainParameters.arcLayerAlphas.x() = showCreeks ? 1.0f : 0.0f;
-        static bool showRoads = true;
-        ImGui::Checkbox("Show roads", &showRoads);
-        terrainParameters.arcLayerAlphas.y() = showRoads ? 1.0f : 0.0f;
-        static bool showGlaciers = true;
-        ImGui::Checkbox("Show glaciers", &showGlaciers);
-        terrainParameters.hydroLayerAlphas.w() = showGlaciers ? 1.0f : 0.0f;
-        static bool showContours = false;
-        ImGui::Checkbox("Show contours", &showContours);
-        terrainParameters.showContoursChunks.x() = showContours ? 1.0f : 0.0f;
+        // Layers are baked into the overlay tiles so changing them rebakes every tile, creek and
+        // road widths are applied by the shader
+        auto layersChanged = false;
+        layersChanged |= ImGui::Checkbox("Show lake outlines", &overlayLayers.lakeOutlines);
+        layersChanged |= ImGui::Checkbox("Show lakes", &overlayLayers.lakes);
+        layersChanged |= ImGui::Checkbox("Show creeks", &overlayLayers.creeks);
+        layersChanged |= ImGui::Checkbox("Show roads", &overlayLayers.roads);
+        ImGui::SliderFloat("Creek width", &terrainParameters.arcLayerWidths.x(), 0.5f,
+                           overlayMaxArcWidth, "width = %.1f pixels");
+        ImGui::SliderFloat("Road width", &terrainParameters.arcLayerWidths.y(), 0.5f,
+                           overlayMaxArcWidth, "width = %.1f pixels");
+        layersChanged |= ImGui::Checkbox("Show glaciers", &overlayLayers.glaciers);
+        layersChanged |= ImGui::Checkbox("Show contours", &overlayLayers.contours);
+        if (layersChanged) overlay->setBakeTile(makeOverlayBaker());
+        ImGui::Text("Overlay tiles: %d needed, %d resident, %d baking", overlay->numNeededTiles(),
+                    overlay->numResidentTiles(), overlay->numPendingTiles());
         if (ImGui::CollapsingHeader("Topographic features")) {
             for (auto& code : displayedConciscodes) {
                 ImGui::Checkbox(conciscodeNameMap[code.first].c_str(), &code.second);
@@ -837,110 +984,167 @@ std::unordered_map<int, std::string> HeightField::initConciscodeNameMap() {
     };
 }
 
-std::vector<HeightField::Arc> HeightField::loadArcShapeFile(
-    const char* filename, const GeoTiff& geoTiff,
-    const std::vector<std::string>& requestedStringAttributes) {
-    std::vector<HeightField::Arc> res;
-    auto shapeFile = ShapeFile{filename};
-    for (const auto& s : shapeFile.getShapes()) {
-        assert(s->nSHPType == SHPT_ARC);
-        assert(s->nParts == 1);
-        res.push_back(Arc{{vector<Vec2f>(s->nVertices)}, {vector<Vec2f>(s->nVertices)}});
-        auto& arc = res.back();
-        for (const auto& stringAttr : requestedStringAttributes) {
-            arc.stringAttributes.emplace_back(
-                stringAttr, shapeFile.readStringAttribute(s->nShapeId, stringAttr.c_str()));
-        }
-        for (size_t i = 0; i < arc.latLongs.size(); ++i) {
-            arc.latLongs[i] = Vec2f{ to<float>(s->padfY[i]), to<float>(s->padfX[i]) };
-            const auto pixelPos = geoTiff.latLongToPixXY(arc.latLongs[i].x(), arc.latLongs[i].y());
-            arc.pixPositions[i] = Vec2f{ pixelPos };
-        }
+// Terrain extent vector layers are culled and clipped to. Padded a little so line caps and
+// outlines at a clipped edge fall outside the textures the layers are rendered into.
+static pair<Vec2f, Vec2f> vectorLayerExtent(const GeoTiff& geoTiff) {
+    const auto bounds = geoTiff.latLongBounds();
+    const auto padding = (bounds.second - bounds.first) * 0.01f;
+    return {bounds.first - padding, bounds.second + padding};
+}
+
+static bool contains(const pair<Vec2f, Vec2f>& outer, const pair<Vec2f, Vec2f>& inner) {
+    return inner.first.x() >= outer.first.x() && inner.first.y() >= outer.first.y() &&
+           inner.second.x() <= outer.second.x() && inner.second.y() <= outer.second.y();
+}
+
+// Decode points [first, first + part.latLongs.size()) of a shape and reproject them in a single
+// pass over the mapped data
+static void decodeAndProject(const MappedShapeFile::Record& s, int first, const GeoTiff& geoTiff,
+                             const VectorLayer::PartData& part) {
+    for (int i = 0; i < to<int>(part.latLongs.size()); ++i) {
+        const auto latLong = s.latLong(first + i);
+        part.latLongs[i] = latLong;
+        part.pixPositions[i] = geoTiff.latLongToPixXY(latLong.x(), latLong.y());
     }
+}
+
+static VectorLayer::PartData addClippedPart(VectorLayer& layer, const vector<Vec2f>& latLongs,
+                                            const GeoTiff& geoTiff) {
+    const auto part = layer.addPart(to<int>(latLongs.size()));
+    copy(begin(latLongs), end(latLongs), begin(part.latLongs));
+    transform(begin(latLongs), end(latLongs), begin(part.pixPositions),
+              [&geoTiff](const auto& latLong) {
+                  return geoTiff.latLongToPixXY(latLong.x(), latLong.y());
+              });
+    return part;
+}
+
+static void addAttributes(VectorLayer& layer, const MappedShapeFile::Record& s,
+                          const vector<const DbfColumns::StringColumn*>& stringColumns) {
+    layer.beginShape();
+    for (const auto column : stringColumns) layer.addAttribute((*column)[s.shapeId()]);
+}
+
+// Shapes are converted in parallel in chunks of this many, small enough to balance layers where a
+// few shapes have most of the vertices. Each chunk builds its own layer and the chunk layers are
+// appended in order afterwards.
+static const auto shapeLoadGrainSize = 16;
+
+static int numShapeLoadChunks(size_t numShapes) {
+    return to<int>((numShapes + shapeLoadGrainSize - 1) / shapeLoadGrainSize);
+}
+
+static VectorLayer concatenate(const vector<VectorLayer>& layers,
+                               const vector<string>& attributeNames) {
+    auto res = VectorLayer{attributeNames};
+    for (const auto& layer : layers) res.append(layer);
     return res;
 }
 
-void HeightField::renderArcsToTexture(const std::vector<Arc>& arcs, ID3D11Texture2D* tex,
-                                      DirectX11& dx11, D2D1::ColorF arcColor) {
-    DrawToRenderTargetTexture(
-        dx11.d2d1Factory1.Get(), dx11.d2d1DeviceContext.Get(), tex,
-        [&arcs, arcColor](ID2D1Factory* factory, ID2D1RenderTarget* d2d1Rt) {
-            auto brush = CreateSolidColorBrush(d2d1Rt, arcColor);
-            d2d1Rt->SetTransform(D2D1::IdentityMatrix());
-            auto pathGeometry = CreatePathGeometry(factory);
-            auto geometrySink = Open(pathGeometry.Get());
-            for (const auto& c : arcs) {
-                bool first = true;
-                for (auto pp : c.pixPositions) {
-                    auto point = D2D1::Point2F(pp.x(), pp.y());
-                    first ? geometrySink->BeginFigure(point, D2D1_FIGURE_BEGIN_HOLLOW)
-                          : geometrySink->AddLine(point);
-                    first = false;
+VectorLayer HeightField::loadArcShapeFile(const char* filename, const GeoTiff& geoTiff,
+                                          const std::vector<std::string>& requestedStringAttributes,
+                                          bool clipToTerrain) {
+    const auto shapeFile = ShapeFile{filename, requestedStringAttributes, {}};
+    auto stringColumns = vector<const DbfColumns::StringColumn*>{};
+    for (const auto& stringAttr : requestedStringAttributes)
+        stringColumns.push_back(&shapeFile.stringColumn(stringAttr.c_str()));
+    const auto extent = vectorLayerExtent(geoTiff);
+    const auto shapeIds = shapeFile.shapesInBounds(extent);
+
+    auto chunks = vector<VectorLayer>(numShapeLoadChunks(shapeIds.size()),
+                                      VectorLayer{requestedStringAttributes});
+    ThreadPool::global().parallelFor(
+        to<int>(shapeIds.size()), shapeLoadGrainSize, [&](int first, int last) {
+            auto& layer = chunks[first / shapeLoadGrainSize];
+            auto latLongs = vector<Vec2f>{};  // reused across shapes in this chunk
+            for (int i = first; i < last; ++i) {
+                const auto s = shapeFile.record(shapeIds[i]);
+                assert(s.shapeType() == SHPT_ARC);
+                assert(s.numParts() == 1);
+                if (!clipToTerrain || contains(extent, s.latLongBounds())) {
+                    addAttributes(layer, s, stringColumns);
+                    const auto part = layer.addPart(s.numPoints());
+                    decodeAndProject(s, 0, geoTiff, part);
+                    polylineSignificance(part.pixPositions, part.significance);
+                } else {
+                    // An arc that leaves and re-enters the terrain becomes several arcs
+                    latLongs.resize(s.numPoints());
+                    s.decodeLatLongs(gsl::as_array_view(latLongs));
+                    for (const auto& clipped :
+                         clipPolyline(const_array_view(latLongs), extent.first, extent.second)) {
+                        addAttributes(layer, s, stringColumns);
+                        const auto part = addClippedPart(layer, clipped, geoTiff);
+                        polylineSignificance(part.pixPositions, part.significance);
+                    }
                 }
-                geometrySink->EndFigure(D2D1_FIGURE_END_OPEN);
             }
-            geometrySink->Close();
-            d2d1Rt->DrawGeometry(pathGeometry.Get(), brush.Get(), 2.0f);
         });
+    return concatenate(chunks, requestedStringAttributes);
 }
 
-std::vector<HeightField::Polygon> HeightField::loadPolygonShapeFile(
-    const char* filename, const GeoTiff& geoTiff,
-    const std::vector<std::string>& requestedStringAttributes) {
-    std::vector<HeightField::Polygon> res;
-    auto shapeFile = ShapeFile{filename};
-    for (const auto& s : shapeFile.getShapes()) {
-        assert(s->nSHPType == SHPT_POLYGON);
-        res.push_back(Polygon{{vector<Vec2f>(s->nVertices)}, {vector<Vec2f>(s->nVertices)}});
-        auto& poly = res.back();
-        for (const auto& stringAttr : requestedStringAttributes) {
-            poly.stringAttributes.emplace_back(
-                stringAttr, shapeFile.readStringAttribute(s->nShapeId, stringAttr.c_str()));
-        }
-        assert(s->nParts > 0);
-        for (int i = 0; i < s->nParts; ++i) {
-            poly.partStarts.push_back(s->panPartStart[i]);
-            assert(s->panPartType[i] == SHPP_RING);
-        }
-        for (size_t i = 0; i < poly.latLongs.size(); ++i) {
-            poly.latLongs[i] = Vec2f{to<float>(s->padfY[i]), to<float>(s->padfX[i])};
-            const auto pixelPos =
-                geoTiff.latLongToPixXY(poly.latLongs[i].x(), poly.latLongs[i].y());
-            poly.pixPositions[i] = Vec2f{pixelPos};
-        }
-    }
-    return res;
+// Keep the rings of the last shape of polygons from crossing when simplified, ringEnds is scratch
+static void preserveLastShapeTopology(VectorLayer& polygons, vector<int>& ringEnds) {
+    const auto shape = polygons[polygons.size() - 1];
+    ringEnds.clear();
+    for (int i = 0; i < shape.numParts(); ++i) ringEnds.push_back(shape.partEnd(i));
+    preserveRingTopology(shape.pixPositions(), const_array_view(ringEnds),
+                         polygons.lastShapeSignificance());
 }
 
-void HeightField::renderPolygonsToTexture(const std::vector<Polygon>& polygons,
-                                          ID3D11Texture2D* tex, DirectX11& dx11,
-                                          D2D1::ColorF outlineColor, D2D1::ColorF fillColor) {
-    DrawToRenderTargetTexture(
-        dx11.d2d1Factory1.Get(), dx11.d2d1DeviceContext.Get(), tex,
-        [&polygons, outlineColor, fillColor](ID2D1Factory* factory, ID2D1RenderTarget* d2d1Rt) {
-            auto brush = CreateSolidColorBrush(d2d1Rt, outlineColor);
-            auto fillBrush = CreateSolidColorBrush(d2d1Rt, fillColor);
-            d2d1Rt->SetTransform(D2D1::IdentityMatrix());
-            auto pathGeometry = CreatePathGeometry(factory);
-            auto geometrySink = Open(pathGeometry.Get());
-            for (const auto& p : polygons) {
-                const auto numParts = to<int>(p.partStarts.size());
-                for (int i = 0; i < numParts; ++i) {
-                    const auto startIndex = p.partStarts[i];
-                    const auto startPoint = p.pixPositions[startIndex];
-                    geometrySink->BeginFigure(D2D1::Point2F(startPoint.x(), startPoint.y()),
-                                              D2D1_FIGURE_BEGIN_FILLED);
-                    const auto endIndex =
-                        i + 1 < numParts ? p.partStarts[i + 1] : to<int>(p.pixPositions.size());
-                    for (int j = startIndex + 1; j < endIndex; ++j) {
-                        const auto point = p.pixPositions[j];
-                        geometrySink->AddLine(D2D1::Point2F(point.x(), point.y()));
+VectorLayer HeightField::loadPolygonShapeFile(
+    const char* filename, const GeoTiff& geoTiff,
+    const std::vector<std::string>& requestedStringAttributes, bool clipToTerrain) {
+    const auto shapeFile = ShapeFile{filename, requestedStringAttributes, {}};
+    auto stringColumns = vector<const DbfColumns::StringColumn*>{};
+    for (const auto& stringAttr : requestedStringAttributes)
+        stringColumns.push_back(&shapeFile.stringColumn(stringAttr.c_str()));
+    const auto extent = vectorLayerExtent(geoTiff);
+    const auto shapeIds = shapeFile.shapesInBounds(extent);
+
+    auto chunks = vector<VectorLayer>(numShapeLoadChunks(shapeIds.size()),
+                                      VectorLayer{requestedStringAttributes});
+    ThreadPool::global().parallelFor(
+        to<int>(shapeIds.size()), shapeLoadGrainSize, [&](int first, int last) {
+            auto& layer = chunks[first / shapeLoadGrainSize];
+            auto latLongs = vector<Vec2f>{};  // reused across shapes in this chunk
+            auto ringEnds = vector<int>{};
+            for (int i = first; i < last; ++i) {
+                const auto s = shapeFile.record(shapeIds[i]);
+                assert(s.shapeType() == SHPT_POLYGON);
+                assert(s.numParts() > 0);
+                const auto partEnd = [&s](int j) {
+                    return j + 1 < s.numParts() ? s.partStart(j + 1) : s.numPoints();
+                };
+                if (!clipToTerrain || contains(extent, s.latLongBounds())) {
+                    addAttributes(layer, s, stringColumns);
+                    for (int j = 0; j < s.numParts(); ++j) {
+                        assert(s.partType(j) == SHPP_RING);
+                        const auto part = layer.addPart(partEnd(j) - s.partStart(j));
+                        decodeAndProject(s, s.partStart(j), geoTiff, part);
+                        ringSignificance(part.pixPositions, part.significance);
+                    }
+                    preserveLastShapeTopology(layer, ringEnds);
+                } else {
+                    // Rings are clipped independently which preserves the filled area, rings that
+                    // end up entirely outside are dropped along with shapes left with no rings
+                    latLongs.resize(s.numPoints());
+                    s.decodeLatLongs(gsl::as_array_view(latLongs));
+                    auto begun = false;
+                    for (int j = 0; j < s.numParts(); ++j) {
+                        assert(s.partType(j) == SHPP_RING);
+                        const auto ring = clipRing(
+                            const_array_view(latLongs).sub(s.partStart(j),
+                                                           partEnd(j) - s.partStart(j)),
+                            extent.first, extent.second);
+                        if (ring.empty()) continue;
+                        if (!begun) addAttributes(layer, s, stringColumns);
+                        begun = true;
+                        const auto part = addClippedPart(layer, ring, geoTiff);
+                        ringSignificance(part.pixPositions, part.significance);
                     }
-                    geometrySink->EndFigure(D2D1_FIGURE_END_CLOSED);
+                    if (begun) preserveLastShapeTopology(layer, ringEnds);
                 }
             }
-            geometrySink->Close();
-            d2d1Rt->FillGeometry(pathGeometry.Get(), fillBrush.Get());
-            d2d1Rt->DrawGeometry(pathGeometry.Get(), brush.Get(), 3.0f);
         });
+    return concatenate(chunks, requestedStringAttributes);
 }
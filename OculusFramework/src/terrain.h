@@ -1,6 +1,9 @@
 #pragma once
 
 #include "label.h"
+#include "spatialindex.h"
+#include "vectorlayer.h"
+#include "virtualoverlay.h"
 #include "Win32_DX11AppUtil.h"
 
 #include "mathconstants.h"
@@ -22,7 +25,8 @@ struct HeightField {
             : R(r), G(g), B(b), A(a) {}
     };
     struct Vertex;
-    struct LabelVertex;
+    struct LabelQuadVertex;
+    struct LabelInstance;
     struct LabelFlagpoleVertex;
 
     HeightField(const mathlib::Vec3f& arg_pos) : Pos{arg_pos}, Rot{0.0f} {}
@@ -30,7 +34,8 @@ struct HeightField {
                      PipelineStateObjectManager& pipelineStateObjectManager,
                      Texture2DManager& texture2DManager);
 
-    void Render(DirectX11& dx11, ID3D11DeviceContext* context);
+    // eye is the world space eye position the overlay resolution is chosen for
+    void Render(DirectX11& dx11, ID3D11DeviceContext* context, const mathlib::Vec3f& eye);
 
     void showGui();
 
@@ -61,17 +66,14 @@ private:
     void generateLabels(const GeoTiff& geoTiff, ID3D11Device* device, ID3D11DeviceContext* context,
                         PipelineStateObjectManager& pipelineStateObjectManager, DirectX11& dx11);
     void loadCreeksShapeFile(const GeoTiff& geoTiff);
-    void generateCreeksTexture(DirectX11& dx11);
-    void renderCreeksTexture(DirectX11& dx11);
     void loadRoadsShapeFile(const GeoTiff& geoTiff);
-    void generateRoadsTexture(DirectX11& dx11);
-    void renderRoadsTexture(DirectX11& dx11);
     void loadLakesShapeFile(const GeoTiff& geoTiff);
-    void generateLakesTexture(DirectX11& dx11);
-    void renderLakesTexture(DirectX11& dx11);
     void loadGlaciersShapeFile(const GeoTiff& geoTiff);
-    void generateGlaciersTexture(DirectX11& dx11);
-    void renderGlaciersTexture(DirectX11& dx11);
+    void generateContours(const GeoTiff& geoTiff);
+    void generateOverlay(ID3D11Device* device);
+    // Tile baker for the vector layers currently shown
+    VirtualOverlay::BakeTile makeOverlayBaker() const;
+    void updateOverlay(ID3D11DeviceContext* context, const mathlib::Vec3f& eye);
 
     static std::unordered_map<int, std::string> initConciscodeNameMap();
 
@@ -105,11 +107,13 @@ private:
     int reducedTris = 0;
 
     std::vector<LabeledPoint> topographicFeatures;
+    PointSpatialIndex topographicFeatureIndex;
     std::vector<Label> topographicFeatureLabels;
-    std::vector<LabelVertex> labelsVertices;
-    std::vector<uint16_t> labelsIndices;
-    ID3D11BufferPtr labelsVertexBuffer;
-    ID3D11BufferPtr labelsIndexBuffer;
+    std::vector<int> labelFeatureIndices;  // index into topographicFeatures for each label
+    std::vector<LabelInstance> labelInstances;
+    ID3D11BufferPtr labelQuadVertexBuffer;
+    ID3D11BufferPtr labelQuadIndexBuffer;
+    ID3D11BufferPtr labelInstanceBuffer;
     PipelineStateObjectManager::ResourceHandle labelsPipelineStateObject;
     std::vector<LabelFlagpoleVertex> labelFlagpoleVertices;
     ID3D11BufferPtr labelFlagpolesVertexBuffer;
@@ -118,54 +122,55 @@ private:
     std::unordered_map<int, std::string> conciscodeNameMap = initConciscodeNameMap();
     std::unordered_map<int, bool> displayedConciscodes;
 
-    struct Arc {
-        std::vector<mathlib::Vec2f> latLongs;
-        std::vector<mathlib::Vec2f> pixPositions;
-        std::vector<std::pair<std::string, std::string>> stringAttributes;
-    };
-    static std::vector<Arc> loadArcShapeFile(
-        const char* filename, const GeoTiff& geoTiff,
-        const std::vector<std::string>& requestedStringAttributes);
-    static void renderArcsToTexture(const std::vector<Arc>& arcs, ID3D11Texture2D* tex,
-                                    DirectX11& dx11, D2D1::ColorF arcColor);
+    // Arc layers have one part per shape, a source shape crossing the terrain edge more than once
+    // is split into several. Shapes outside the terrain are always skipped, clipToTerrain also
+    // trims those crossing its edge.
+    static VectorLayer loadArcShapeFile(const char* filename, const GeoTiff& geoTiff,
+                                        const std::vector<std::string>& requestedStringAttributes,
+                                        bool clipToTerrain);
 
-    std::vector<Arc> creeks;
-    ID3D11Texture2DPtr creeksTex;
-    ID3D11ShaderResourceViewPtr creeksSrv;
+    VectorLayer creeks;
+    VectorLayer roads;
 
-    std::vector<Arc> roads;
-
-    struct Polygon {
-        std::vector<mathlib::Vec2f> latLongs;
-        std::vector<mathlib::Vec2f> pixPositions;
-        std::vector<int> partStarts;
-        std::vector<std::pair<std::string, std::string>> stringAttributes;
-    };
-    static std::vector<Polygon> loadPolygonShapeFile(
+    // Polygon layers have one part per ring
+    static VectorLayer loadPolygonShapeFile(
         const char* filename, const GeoTiff& geoTiff,
-        const std::vector<std::string>& requestedStringAttributes);
-    static void renderPolygonsToTexture(const std::vector<Polygon>& polygons, ID3D11Texture2D* tex,
-                                        DirectX11& dx11, D2D1::ColorF outlineColor,
-                                        D2D1::ColorF fillColor);
+        const std::vector<std::string>& requestedStringAttributes, bool clipToTerrain);
 
-    std::vector<Polygon> lakes;
-    ID3D11Texture2DPtr lakesAndGlaciersTex;
-    ID3D11ShaderResourceViewPtr lakesAndGlaciersSrv;
+    VectorLayer lakes;
+    VectorLayer glaciers;
 
-    std::vector<Polygon> glaciers;
+    // Arc layer of contour lines from the heightfield
+    VectorLayer contours;
+
+    // Vector layers baked into the overlay
+    struct OverlayLayers {
+        bool creeks = true;
+        bool roads = true;
+        bool lakeOutlines = true;
+        bool lakes = true;
+        bool glaciers = true;
+        bool contours = false;
+    } overlayLayers;
+    std::unique_ptr<VirtualOverlay> overlay;
 
     struct TerrainParameters {
         mathlib::Vector<uint32_t, 4> chunkInfo = {0u, 0u, 0u, 0u};
         mathlib::Vec2f minMaxTerrainHeight = {0.0f, 0.0f};
         mathlib::Vec2f terrainWidthHeightMeters = {0.0f, 0.0f};
-        mathlib::Vec4f arcLayerAlphas = {1.0f, 1.0f, 1.0f, 1.0f};
-        mathlib::Vec4f hydroLayerAlphas = {1.0f, 1.0f, 1.0f, 1.0f};
-        mathlib::Vec4f showContoursChunks = {0.0f, 0.0f, 0.0f, 0.0f};
+        mathlib::Vec4f showChunks = {0.0f, 0.0f, 0.0f, 0.0f};
+        // VirtualOverlay::shaderParameters()
+        mathlib::Vec4f overlayParameters = {0.0f, 0.0f, 0.0f, 0.0f};
+        // VirtualOverlay::distanceParameters()
+        mathlib::Vec2f overlayDistanceParameters = {0.0f, 0.0f};
+        // Creek and road widths in heightfield pixels, drawn from the overlay distance fields
+        mathlib::Vec2f arcLayerWidths = {2.0f, 2.0f};
     } terrainParameters;
     ID3D11BufferPtr terrainParametersConstantBuffer;
 
     int heightFieldWidth = 0;
     int heightFieldHeight = 0;
+    mathlib::Vec2f gridStepMeters = {0.0f, 0.0f};
 };
 
 struct HeightField::Vertex {
@@ -176,23 +181,34 @@ static const auto HeightFieldVertexInputElementDescs = {
     MAKE_INPUT_ELEMENT_DESC(HeightField::Vertex, position),
     MAKE_INPUT_ELEMENT_DESC(HeightField::Vertex, texcoord)};
 
-struct HeightField::LabelVertex {
+// Labels are drawn as instanced quads: slot 0 holds a single unit quad whose corners are expanded
+// in the vertex shader using the per label data in slot 1.
+struct HeightField::LabelQuadVertex {
+    mathlib::Vec2f corner;
+};
+
+struct HeightField::LabelInstance {
     mathlib::Vec3f position;
     std::uint32_t color;
-    mathlib::Vec2f texcoord;
     mathlib::Vec2f labelSize;
+    mathlib::Vec4f uvRect;
 };
-static const auto HeightFieldLabelVertexInputElementDescs = {
-    MAKE_INPUT_ELEMENT_DESC(HeightField::LabelVertex, position),
-    MAKE_INPUT_ELEMENT_DESC(HeightField::LabelVertex, color),
-    MAKE_INPUT_ELEMENT_DESC(HeightField::LabelVertex, texcoord),
-    MAKE_INPUT_ELEMENT_DESC(HeightField::LabelVertex, labelSize, "texcoord", 1)
+static const auto HeightFieldLabelInputElementDescs = {
+    MAKE_INPUT_ELEMENT_DESC(HeightField::LabelQuadVertex, corner, "texcoord", 0),
+    MAKE_INPUT_ELEMENT_DESC(HeightField::LabelInstance, position, nullptr, 0, 1,
+                            D3D11_INPUT_PER_INSTANCE_DATA, 1),
+    MAKE_INPUT_ELEMENT_DESC(HeightField::LabelInstance, color, nullptr, 0, 1,
+                            D3D11_INPUT_PER_INSTANCE_DATA, 1),
+    MAKE_INPUT_ELEMENT_DESC(HeightField::LabelInstance, labelSize, "texcoord", 1, 1,
+                            D3D11_INPUT_PER_INSTANCE_DATA, 1),
+    MAKE_INPUT_ELEMENT_DESC(HeightField::LabelInstance, uvRect, "texcoord", 2, 1,
+                            D3D11_INPUT_PER_INSTANCE_DATA, 1)
 };
 
 struct HeightField::LabelFlagpoleVertex {
     mathlib::Vec3f position;
 };
 static const auto HeightFieldLabelFlagpoleVertexInputElementDescs = {
-    MAKE_INPUT_ELEMENT_DESC(HeightField::LabelVertex, position)
+    MAKE_INPUT_ELEMENT_DESC(HeightField::LabelFlagpoleVertex, position)
 };
 
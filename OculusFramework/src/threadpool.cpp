@@ -0,0 +1,44 @@
+#include "threadpool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int numThreads) {
+    for (int i = 0; i < numThreads; ++i) workers.emplace_back([this] { workerLoop(); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock{tasksMutex};
+        stopping = true;
+    }
+    tasksAvailable.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+ThreadPool& ThreadPool::global() {
+    // Leave a core for the thread doing the submitting, it takes part in parallelFor()
+    static ThreadPool pool{max(1, static_cast<int>(thread::hardware_concurrency()) - 1)};
+    return pool;
+}
+
+void ThreadPool::enqueue(function<void()> task) {
+    {
+        lock_guard<mutex> lock{tasksMutex};
+        tasks.push(move(task));
+    }
+    tasksAvailable.notify_one();
+}
+
+void ThreadPool::workerLoop() {
+    for (;;) {
+        auto task = function<void()>{};
+        {
+            unique_lock<mutex> lock{tasksMutex};
+            tasksAvailable.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) return;  // only when stopping
+            task = move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Simple fixed size pool of worker threads for CPU heavy load time work. Tasks are run in FIFO
+// order. parallelFor() has the calling thread take part in the work and only waits on chunks that
+// have actually started so it is safe to call from inside a task running on the same pool.
+class ThreadPool {
+public:
+    explicit ThreadPool(int numThreads);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    int size() const { return static_cast<int>(workers.size()); }
+
+    template <typename F>
+    auto submit(F f) -> std::future<decltype(f())> {
+        auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+        auto res = task->get_future();
+        enqueue([task] { (*task)(); });
+        return res;
+    }
+
+    // Call f(begin, end) for chunks of at most grainSize covering [0, count) and wait for them
+    // all. The first exception thrown by f is rethrown on the calling thread.
+    template <typename F>
+    void parallelFor(int count, int grainSize, F f);
+
+    // Shared pool sized to the hardware, created on first use
+    static ThreadPool& global();
+
+private:
+    void enqueue(std::function<void()> task);
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex tasksMutex;
+    std::condition_variable tasksAvailable;
+    bool stopping = false;
+};
+
+template <typename F>
+void ThreadPool::parallelFor(int count, int grainSize, F f) {
+    if (count <= 0) return;
+    grainSize = std::max(grainSize, 1);
+    const auto numChunks = (count + grainSize - 1) / grainSize;
+    if (numChunks == 1 || workers.empty()) {
+        f(0, count);
+        return;
+    }
+
+    // Helpers may start after the caller has returned if all the chunks were claimed before they
+    // ran so the shared state outlives this call and f is only touched through a claimed chunk.
+    struct State {
+        std::atomic<int> nextChunk{0};
+        int completedChunks = 0;
+        std::exception_ptr exception;
+        std::mutex doneMutex;
+        std::condition_variable done;
+    };
+    auto state = std::make_shared<State>();
+    const auto runChunks = [state, numChunks, count, grainSize, &f] {
+        for (auto chunk = state->nextChunk++; chunk < numChunks; chunk = state->nextChunk++) {
+            auto exception = std::exception_ptr{};
+            try {
+                const auto begin = chunk * grainSize;
+                f(begin, std::min(begin + grainSize, count));
+            } catch (...) {
+                exception = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock{state->doneMutex};
+            if (exception && !state->exception) state->exception = exception;
+            if (++state->completedChunks == numChunks) state->done.notify_all();
+        }
+    };
+    const auto numHelpers = std::min(size(), numChunks - 1);
+    for (int i = 0; i < numHelpers; ++i) enqueue(runChunks);
+    runChunks();
+
+    std::unique_lock<std::mutex> lock{state->doneMutex};
+    state->done.wait(lock, [&state, numChunks] { return state->completedChunks == numChunks; });
+    if (state->exception) std::rethrow_exception(state->exception);
+}
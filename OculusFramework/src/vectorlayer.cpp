@@ -0,0 +1,144 @@
+#include "vectorlayer.h"
+
+#include "farmhash.h"
+#include "util.h"
+
+#include <cassert>
+#include <cmath>
+#include <iterator>
+#include <unordered_set>
+
+using namespace std;
+
+using namespace mathlib;
+using namespace util;
+
+int VectorLayer::Shape::partBegin(int part) const {
+    assert(part >= 0 && part < numParts());
+    return layer->partFirstPoint[firstPart() + part] - firstPoint();
+}
+
+int VectorLayer::Shape::partEnd(int part) const {
+    assert(part >= 0 && part < numParts());
+    return layer->partFirstPoint[firstPart() + part + 1] - firstPoint();
+}
+
+gsl::array_view<const Vec2f> VectorLayer::Shape::latLongs() const {
+    return {layer->latLongs.data() + firstPoint(), numPoints()};
+}
+
+gsl::array_view<const Vec2f> VectorLayer::Shape::pixPositions() const {
+    return {layer->pixPositions.data() + firstPoint(), numPoints()};
+}
+
+gsl::array_view<const float> VectorLayer::Shape::significance() const {
+    return {layer->significance.data() + firstPoint(), numPoints()};
+}
+
+const string& VectorLayer::Shape::attribute(int i) const {
+    const auto numAttributes = layer->attributeNames.size();
+    assert(size_t(i) < numAttributes);
+    return layer->strings[layer->shapeAttributes[index * numAttributes + i]];
+}
+
+VectorLayer::VectorLayer(vector<string> attributeNames_) : attributeNames{move(attributeNames_)} {}
+
+void VectorLayer::beginShape() {
+    assert(shapeAttributes.size() == size() * attributeNames.size());
+    shapeFirstPart.push_back(shapeFirstPart.back());
+}
+
+void VectorLayer::addAttribute(const string& value) {
+    assert(size() > 0 && shapeAttributes.size() < size() * attributeNames.size());
+    shapeAttributes.push_back(intern(value));
+}
+
+VectorLayer::PartData VectorLayer::addPart(int numPartPoints) {
+    assert(size() > 0);
+    const auto first = latLongs.size();
+    latLongs.resize(first + numPartPoints);
+    pixPositions.resize(first + numPartPoints);
+    significance.resize(first + numPartPoints);
+    partFirstPoint.push_back(static_cast<int>(latLongs.size()));
+    ++shapeFirstPart.back();
+    return {{latLongs.data() + first, numPartPoints},
+            {pixPositions.data() + first, numPartPoints},
+            {significance.data() + first, numPartPoints}};
+}
+
+gsl::array_view<float> VectorLayer::lastShapeSignificance() {
+    assert(size() > 0);
+    const auto shapePoints = (*this)[size() - 1].numPoints();
+    return {significance.data() + significance.size() - shapePoints, shapePoints};
+}
+
+void VectorLayer::append(const VectorLayer& x) {
+    assert(attributeNames == x.attributeNames);
+    const auto pointOffset = numPoints();
+    const auto partOffset = static_cast<int>(partFirstPoint.size()) - 1;
+    latLongs.insert(std::end(latLongs), std::begin(x.latLongs), std::end(x.latLongs));
+    pixPositions.insert(std::end(pixPositions), std::begin(x.pixPositions),
+                        std::end(x.pixPositions));
+    significance.insert(std::end(significance), std::begin(x.significance),
+                        std::end(x.significance));
+    partFirstPoint.reserve(partFirstPoint.size() + x.partFirstPoint.size() - 1);
+    for (size_t i = 1; i < x.partFirstPoint.size(); ++i)
+        partFirstPoint.push_back(x.partFirstPoint[i] + pointOffset);
+    shapeFirstPart.reserve(shapeFirstPart.size() + x.shapeFirstPart.size() - 1);
+    for (size_t i = 1; i < x.shapeFirstPart.size(); ++i)
+        shapeFirstPart.push_back(x.shapeFirstPart[i] + partOffset);
+    shapeAttributes.reserve(shapeAttributes.size() + x.shapeAttributes.size());
+    for (const auto id : x.shapeAttributes) shapeAttributes.push_back(intern(x.strings[id]));
+}
+
+void VectorLayer::append(const Shape& shape) {
+    assert(attributeNames == shape.layer->attributeNames);
+    beginShape();
+    for (int i = 0; i < shape.numAttributes(); ++i) addAttribute(shape.attribute(i));
+    const auto shapeLatLongs = shape.latLongs();
+    const auto shapePixPositions = shape.pixPositions();
+    const auto shapeSignificance = shape.significance();
+    for (int i = 0; i < shape.numParts(); ++i) {
+        const auto first = shape.partBegin(i);
+        const auto count = shape.partEnd(i) - first;
+        const auto part = addPart(count);
+        copy_n(shapeLatLongs.begin() + first, count, part.latLongs.begin());
+        copy_n(shapePixPositions.begin() + first, count, part.pixPositions.begin());
+        copy_n(shapeSignificance.begin() + first, count, part.significance.begin());
+    }
+}
+
+uint32_t VectorLayer::intern(const string& s) {
+    const auto inserted = stringIds.emplace(s, static_cast<uint32_t>(strings.size()));
+    if (inserted.second) strings.push_back(s);
+    return inserted.first->second;
+}
+
+uint64_t fingerprint(const VectorLayer::Shape& shape) {
+    // 1e-5 degrees is at most about a meter
+    const auto quantize = [](float x) { return static_cast<int32_t>(lround(x * 1e5f)); };
+    auto data = vector<int32_t>{};
+    data.reserve(shape.numParts() + 2 * shape.numPoints());
+    for (int i = 0; i < shape.numParts(); ++i) data.push_back(shape.partEnd(i));
+    for (const auto& latLong : shape.latLongs()) {
+        data.push_back(quantize(latLong.x()));
+        data.push_back(quantize(latLong.y()));
+    }
+    auto res = Fingerprint64(reinterpret_cast<const char*>(data.data()),
+                             data.size() * sizeof(data[0]));
+    for (int i = 0; i < shape.numAttributes(); ++i)
+        res = Fingerprint(Uint128(res, Fingerprint64(shape.attribute(i))));
+    return res;
+}
+
+VectorLayer mergeVectorLayers(const vector<VectorLayer>& layers) {
+    if (layers.empty()) return {};
+    auto res = VectorLayer{layers.front().getAttributeNames()};
+    auto seen = unordered_set<uint64_t>{};
+    for (const auto& layer : layers) {
+        for (const auto shape : layer) {
+            if (seen.insert(fingerprint(shape)).second) res.append(shape);
+        }
+    }
+    return res;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "vector.h"
+
+#pragma warning(push)
+#pragma warning(disable : 4245)
+#include <array_view.h>
+#pragma warning(pop)
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Flat structure of arrays storage for a layer of vector shapes (arcs or polygons). All points of
+// all shapes live in one pool of parallel arrays, shapes and parts are ranges of it described by
+// offset tables and attribute values are interned in a per layer string table. Building a layer
+// does a handful of allocations regardless of the number of shapes and traversal walks memory
+// linearly. Shapes are accessed through lightweight Shape views.
+//
+// Arcs are single part shapes, polygons have one part per ring. Point significance is the per
+// point simplification level from simplify.h.
+class VectorLayer {
+public:
+    class Shape {
+    public:
+        Shape(const VectorLayer* l, int i) : layer{l}, index{i} {}
+
+        int numParts() const { return layer->shapeFirstPart[index + 1] - firstPart(); }
+        int numPoints() const { return layer->partFirstPoint[lastPart()] - firstPoint(); }
+        // Range of part i's points relative to the start of this shape's points
+        int partBegin(int part) const;
+        int partEnd(int part) const;
+
+        gsl::array_view<const mathlib::Vec2f> latLongs() const;
+        gsl::array_view<const mathlib::Vec2f> pixPositions() const;
+        gsl::array_view<const float> significance() const;
+        int numAttributes() const { return static_cast<int>(layer->attributeNames.size()); }
+        // Value of the attribute named getAttributeNames()[i]
+        const std::string& attribute(int i) const;
+
+    private:
+        int firstPart() const { return layer->shapeFirstPart[index]; }
+        int lastPart() const { return layer->shapeFirstPart[index + 1]; }
+        int firstPoint() const { return layer->partFirstPoint[firstPart()]; }
+
+        friend class VectorLayer;
+
+        const VectorLayer* layer;
+        int index;
+    };
+
+    class iterator {
+    public:
+        iterator(const VectorLayer* l, int i) : layer{l}, index{i} {}
+        Shape operator*() const { return {layer, index}; }
+        iterator& operator++() {
+            ++index;
+            return *this;
+        }
+        bool operator==(const iterator& x) const { return index == x.index; }
+        bool operator!=(const iterator& x) const { return index != x.index; }
+
+    private:
+        const VectorLayer* layer;
+        int index;
+    };
+
+    // Storage for a newly added part, to be filled in place. Only valid until the next addPart().
+    struct PartData {
+        gsl::array_view<mathlib::Vec2f> latLongs;
+        gsl::array_view<mathlib::Vec2f> pixPositions;
+        gsl::array_view<float> significance;
+    };
+
+    VectorLayer() = default;
+    explicit VectorLayer(std::vector<std::string> attributeNames);
+
+    const auto& getAttributeNames() const { return attributeNames; }
+    int size() const { return static_cast<int>(shapeFirstPart.size()) - 1; }
+    int numPoints() const { return static_cast<int>(latLongs.size()); }
+    Shape operator[](int i) const { return {this, i}; }
+    iterator begin() const { return {this, 0}; }
+    iterator end() const { return {this, size()}; }
+
+    // Start a new shape. Its attribute values must then be added in attributeNames order followed
+    // by its parts.
+    void beginShape();
+    void addAttribute(const std::string& value);
+    PartData addPart(int numPoints);
+    // Significance of the last shape's points, to adjust once all its parts are added. Only valid
+    // until the next addPart().
+    gsl::array_view<float> lastShapeSignificance();
+
+    // Append all of x's shapes, the layers must have the same attributes
+    void append(const VectorLayer& x);
+    // Append a single shape of a layer with the same attributes
+    void append(const Shape& shape);
+
+private:
+    std::uint32_t intern(const std::string& s);
+
+    std::vector<std::string> attributeNames;
+
+    // Point pool
+    std::vector<mathlib::Vec2f> latLongs;
+    std::vector<mathlib::Vec2f> pixPositions;
+    std::vector<float> significance;
+
+    std::vector<int> partFirstPoint{0};  // numParts + 1 offsets into the point pool
+    std::vector<int> shapeFirstPart{0};  // size() + 1 offsets into partFirstPoint
+    std::vector<std::uint32_t> shapeAttributes;  // attributeNames.size() per shape into strings
+
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, std::uint32_t> stringIds;
+};
+
+// Fingerprint of a shape's geometry and attribute values identifying the same feature in
+// different sources. Lat/longs are quantized to about a meter first so differences in source
+// precision don't matter.
+std::uint64_t fingerprint(const VectorLayer::Shape& shape);
+
+// Merge layers with the same attributes, e.g. one layer loaded from several overlapping
+// extracts, keeping only the first of the shapes with equal fingerprints. Shapes are in layer
+// order.
+VectorLayer mergeVectorLayers(const std::vector<VectorLayer>& layers);
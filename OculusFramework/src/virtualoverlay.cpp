@@ -0,0 +1,292 @@
+#include "virtualoverlay.h"
+
+#include "threadpool.h"
+#include "util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <queue>
+
+using namespace std;
+
+using namespace mathlib;
+using namespace util;
+
+VirtualOverlay::VirtualOverlay(ID3D11Device* device, int width, int height, float maxScale,
+                               int atlasPages,
+                               const array<MipFilter, overlayMaskLayers>& layerFilters,
+                               float maxDistance, BakeTile bakeTile)
+    : overlayWidth{width},
+      overlayHeight{height},
+      finestScale{maxScale},
+      pagesPerSide{atlasPages},
+      maxFieldDistance{maxDistance},
+      currentBakeTile{make_shared<const BakeTile>(move(bakeTile))} {
+    if (atlasPages < 1 || atlasPages > 256) throw runtime_error{"Bad virtual overlay atlas size"};
+    while (levelTilesX(numLevels - 1) > 1 || levelTilesY(numLevels - 1) > 1) ++numLevels;
+    for (int layer = 0; layer < overlayMaskLayers; ++layer)
+        tileMipOptions[layer / 4].filters[layer % 4] = layerFilters[layer];
+
+    tie(atlasTex, atlasSrvPtr) = CreateTexture2DAndShaderResourceView(
+        device, Texture2DDesc{DXGI_FORMAT_R16_UINT, to<UINT>(atlasPages * tileSize),
+                              to<UINT>(atlasPages * tileSize)}
+                    .mipLevels(tileMipLevels),
+        "VirtualOverlay::atlas");
+    tie(distanceAtlasTex, distanceAtlasSrvPtr) = CreateTexture2DAndShaderResourceView(
+        device, Texture2DDesc{DXGI_FORMAT_R8G8_UNORM, to<UINT>(atlasPages * tileSize),
+                              to<UINT>(atlasPages * tileSize)}
+                    .mipLevels(tileMipLevels),
+        "VirtualOverlay::distanceAtlas");
+    indirection = vector<uint8_t>(size_t(levelTilesX(0)) * levelTilesY(0) * 4);
+    tie(indirectionTex, indirectionSrvPtr) = CreateTexture2DAndShaderResourceView(
+        device, Texture2DDesc{DXGI_FORMAT_R8G8B8A8_UINT, to<UINT>(levelTilesX(0)),
+                              to<UINT>(levelTilesY(0))}
+                    .mipLevels(1),
+        {indirection.data(), to<UINT>(levelTilesX(0) * 4)}, "VirtualOverlay::indirection");
+
+    // Hand out pages in atlas order
+    for (int page = atlasPages * atlasPages - 1; page >= 0; --page) freePages.push_back(page);
+}
+
+VirtualOverlay::~VirtualOverlay() {
+    // Bakes in flight may reference data owned by our owner
+    for (auto& p : pending) p.second.mips.wait();
+}
+
+uint64_t VirtualOverlay::tileId(const Tile& tile) {
+    return uint64_t(tile.level) << 48 | uint64_t(tile.y) << 24 | uint64_t(tile.x);
+}
+
+float VirtualOverlay::levelScale(int level) const { return ldexp(finestScale, -level); }
+
+float VirtualOverlay::distanceRange(int level) const {
+    return maxFieldDistance + distanceMargin / levelScale(level);
+}
+
+int VirtualOverlay::levelTilesX(int level) const {
+    return to<int>(ceil(overlayWidth * levelScale(level) / tileContentSize));
+}
+
+int VirtualOverlay::levelTilesY(int level) const {
+    return to<int>(ceil(overlayHeight * levelScale(level) / tileContentSize));
+}
+
+Vec4f VirtualOverlay::shaderParameters() const {
+    return {overlayWidth * finestScale, overlayHeight * finestScale, float(tileContentSize),
+            float(tileSize)};
+}
+
+Vec2f VirtualOverlay::distanceParameters() const {
+    return {maxFieldDistance, distanceMargin / finestScale};
+}
+
+void VirtualOverlay::update(ID3D11DeviceContext* context, const Vec2f& eye, float eyeHeight,
+                            float pixelsPerRadian) {
+    ++frame;
+    selectTiles(eye, eyeHeight, pixelsPerRadian);
+    // Mark needed tiles as used so they aren't evicted for this frame's uploads
+    for (const auto& tile : needed) {
+        const auto r = resident.find(tileId(tile));
+        if (r == resident.end()) continue;
+        r->second.lastUsedFrame = frame;
+        lru.splice(lru.begin(), lru, r->second.lruPosition);
+    }
+    uploadBakedTiles(context);
+    requestTiles();
+    updateIndirection(context);
+}
+
+void VirtualOverlay::setBakeTile(BakeTile bakeTile) {
+    currentBakeTile = make_shared<const BakeTile>(move(bakeTile));
+    // Bakes in flight are dropped when they complete
+    ++generation;
+    for (const auto& r : resident) freePages.push_back(r.second.page);
+    resident.clear();
+    lru.clear();
+}
+
+void VirtualOverlay::selectTiles(const Vec2f& eye, float eyeHeight, float pixelsPerRadian) {
+    // Texels per screen pixel of tile at its nearest point to the eye
+    const auto resolution = [this, &eye, eyeHeight, pixelsPerRadian](const Tile& tile) {
+        const auto scale = levelScale(tile.level);
+        const auto extent = tileContentSize / scale;
+        const auto x0 = tile.x * extent;
+        const auto y0 = tile.y * extent;
+        const auto x1 = min(x0 + extent, float(overlayWidth));
+        const auto y1 = min(y0 + extent, float(overlayHeight));
+        const auto dx = max({x0 - eye.x(), 0.0f, eye.x() - x1});
+        const auto dy = max({y0 - eye.y(), 0.0f, eye.y() - y1});
+        return scale * max(sqrt(dx * dx + dy * dy + eyeHeight * eyeHeight), 1e-3f) /
+               pixelsPerRadian;
+    };
+
+    // Split the quadtree from the root, most under resolved tile first, until each tile has a
+    // texel per screen pixel or splitting further would need more tiles than the atlas holds
+    needed.assign(1, Tile{numLevels - 1, 0, 0});
+    auto split = vector<bool>(1, false);
+    auto candidates = priority_queue<pair<float, int>>{};
+    const auto addCandidate = [&](int i) {
+        const auto r = resolution(needed[i]);
+        if (needed[i].level > 0 && r < 1.0f) candidates.push({-r, i});
+    };
+    addCandidate(0);
+    const auto maxTiles = size_t(pagesPerSide) * pagesPerSide;
+    while (!candidates.empty()) {
+        const auto i = candidates.top().second;
+        candidates.pop();
+        const auto tile = needed[i];
+        const auto level = tile.level - 1;
+        const auto x1 = min(tile.x * 2 + 2, levelTilesX(level));
+        const auto y1 = min(tile.y * 2 + 2, levelTilesY(level));
+        if (needed.size() + (x1 - tile.x * 2) * (y1 - tile.y * 2) > maxTiles) break;
+        split[i] = true;
+        for (int y = tile.y * 2; y < y1; ++y) {
+            for (int x = tile.x * 2; x < x1; ++x) {
+                needed.push_back({level, x, y});
+                split.push_back(false);
+                addCandidate(to<int>(needed.size()) - 1);
+            }
+        }
+    }
+
+    neededLeaves.clear();
+    for (size_t i = 0; i < needed.size(); ++i)
+        if (!split[i]) neededLeaves.push_back(needed[i]);
+    stable_sort(begin(needed), end(needed),
+                [](const Tile& a, const Tile& b) { return a.level > b.level; });
+}
+
+int VirtualOverlay::allocatePage() {
+    if (!freePages.empty()) {
+        const auto page = freePages.back();
+        freePages.pop_back();
+        return page;
+    }
+    if (lru.empty()) return -1;
+    const auto victim = resident.find(lru.back());
+    if (victim->second.lastUsedFrame == frame) return -1;
+    const auto page = victim->second.page;
+    lru.pop_back();
+    resident.erase(victim);
+    return page;
+}
+
+void VirtualOverlay::uploadBakedTiles(ID3D11DeviceContext* context) {
+    for (auto it = begin(pending); it != end(pending);) {
+        auto& p = it->second;
+        if (p.mips.wait_for(chrono::seconds{0}) != future_status::ready) {
+            ++it;
+            continue;
+        }
+        const auto mips = p.mips.get();
+        const auto page = p.generation == generation ? allocatePage() : -1;
+        if (page >= 0) {
+            for (size_t level = 0; level < mips.masks.size(); ++level) {
+                const auto& image = mips.masks[level];
+                const auto size = tileSize >> level;
+                const auto box = D3D11_BOX{to<UINT>(page % pagesPerSide * size),
+                                           to<UINT>(page / pagesPerSide * size),
+                                           0,
+                                           to<UINT>((page % pagesPerSide + 1) * size),
+                                           to<UINT>((page / pagesPerSide + 1) * size),
+                                           1};
+                context->UpdateSubresource(atlasTex.Get(), to<UINT>(level), &box, image.data(),
+                                           to<UINT>(image.rowPitch()), 0);
+                context->UpdateSubresource(distanceAtlasTex.Get(), to<UINT>(level), &box,
+                                           mips.distances[level].data(), to<UINT>(size * 2), 0);
+            }
+            lru.push_front(it->first);
+            resident[it->first] = ResidentTile{page, frame, begin(lru)};
+        }
+        it = pending.erase(it);
+    }
+}
+
+void VirtualOverlay::requestTiles() {
+    // Only request tiles there will be a page for, pages of tiles needed this frame are pinned
+    auto availablePages = int(freePages.size());
+    for (const auto& r : resident)
+        if (r.second.lastUsedFrame != frame) ++availablePages;
+    for (const auto& p : pending)
+        if (p.second.generation == generation) --availablePages;
+    // Keep the pool busy without queueing so much that the view moves on before it completes
+    const auto maxPending = 2 * ThreadPool::global().size();
+
+    // Coarsest first so there is always something to fall back to
+    for (const auto& tile : needed) {
+        if (availablePages <= 0 || int(pending.size()) >= maxPending) break;
+        const auto id = tileId(tile);
+        if (resident.count(id) || pending.count(id)) continue;
+        const auto scale = levelScale(tile.level);
+        // Offset by the border
+        const auto origin = Vec2f{float(tile.x * tileContentSize - tileBorder) / scale,
+                                  float(tile.y * tileContentSize - tileBorder) / scale};
+        const auto maxDistance = distanceRange(tile.level) * scale;
+        auto mips = ThreadPool::global().submit([bakeTile = currentBakeTile,
+                                                 mipOptions = tileMipOptions, origin, scale,
+                                                 maxDistance] {
+            auto layers = OverlayLayerImages{};
+            for (auto& image : layers) image = RgbaImage{tileSize, tileSize};
+            auto distances = RgbaImage{tileSize, tileSize};
+            for (int y = 0; y < tileSize; ++y)
+                fill_n(distances.row(y), tileSize, Rgba{255, 255, 255, 255});
+            (*bakeTile)(layers, distances, origin, scale, maxDistance);
+            // Mips are built at 8 bits and each level packed separately, distances are averaged
+            auto chains = vector<MipChain>{};
+            for (size_t i = 0; i < layers.size(); ++i)
+                chains.push_back(MipChain{move(layers[i]), mipOptions[i], tileMipLevels});
+            const auto distanceChain = MipChain{move(distances), MipChainOptions{}, tileMipLevels};
+            auto res = BakedTile{};
+            for (int level = 0; level < tileMipLevels; ++level) {
+                auto levelLayers = array<const RgbaImage*, overlayMaskLayers / 4>{};
+                for (size_t i = 0; i < chains.size(); ++i)
+                    levelLayers[i] = &chains[i].level(level);
+                res.masks.push_back(packOverlayMask(levelLayers));
+                const auto& levelDistances = distanceChain.level(level);
+                auto texels = vector<uint8_t>{};
+                texels.reserve(size_t(levelDistances.width()) * levelDistances.height() * 2);
+                for (int y = 0; y < levelDistances.height(); ++y) {
+                    for (int x = 0; x < levelDistances.width(); ++x) {
+                        texels.push_back(levelDistances.row(y)[x].r);
+                        texels.push_back(levelDistances.row(y)[x].g);
+                    }
+                }
+                res.distances.push_back(move(texels));
+            }
+            return res;
+        });
+        pending.emplace(id, PendingTile{tile, generation, move(mips)});
+        --availablePages;
+    }
+}
+
+void VirtualOverlay::updateIndirection(ID3D11DeviceContext* context) {
+    // Point the level 0 tiles under each leaf at the leaf or its nearest resident ancestor
+    const auto tilesX = levelTilesX(0);
+    const auto tilesY = levelTilesY(0);
+    auto entries = vector<uint8_t>(indirection.size());
+    for (const auto& leaf : neededLeaves) {
+        auto tile = leaf;
+        auto r = resident.find(tileId(tile));
+        while (r == resident.end() && tile.level + 1 < numLevels) {
+            tile = Tile{tile.level + 1, tile.x / 2, tile.y / 2};
+            r = resident.find(tileId(tile));
+        }
+        if (r == resident.end()) continue;
+        const auto span = 1 << leaf.level;
+        for (int y = leaf.y * span; y < min((leaf.y + 1) * span, tilesY); ++y) {
+            for (int x = leaf.x * span; x < min((leaf.x + 1) * span, tilesX); ++x) {
+                const auto entry = &entries[(size_t(y) * tilesX + x) * 4];
+                entry[0] = uint8_t(r->second.page % pagesPerSide);
+                entry[1] = uint8_t(r->second.page / pagesPerSide);
+                entry[2] = uint8_t(tile.level);
+                entry[3] = 1;
+            }
+        }
+    }
+    if (entries == indirection) return;
+    indirection = move(entries);
+    context->UpdateSubresource(indirectionTex.Get(), 0, nullptr, indirection.data(),
+                               to<UINT>(tilesX * 4), 0);
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "mipchain.h"
+#include "overlaymask.h"
+
+#include "vector.h"
+
+#include "d3dhelper.h"
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Vector overlay for the terrain baked on demand into fixed size tiles at the resolution the view
+// needs. Tiles form a quadtree over the overlay, level 0 is the finest at maxScale texels per
+// pixPositions unit and each coarser level halves that. Baked tiles are packed as overlay masks
+// into the pages of an atlas texture managed as an LRU cache and an indirection texture with one
+// entry per level 0 tile points each part of the overlay at the page to sample. Tiles are baked
+// on the global thread pool along with their mip levels, until one arrives the nearest resident
+// coarser tile is used instead. Each tile also holds two distance fields in a second atlas so the
+// shader can draw lines from them at widths chosen at runtime.
+class VirtualOverlay {
+public:
+    // Tiles are tileSize texels square with a tileBorder texel border around tileContentSize
+    // texels of content, wide enough for bilinear filtering in each of the tileMipLevels levels
+    static const int tileSize = 256;
+    static const int tileMipLevels = 3;
+    static const int tileBorder = 1 << (tileMipLevels - 1);
+    static const int tileContentSize = tileSize - 2 * tileBorder;
+
+    // Bake the overlay's layers into layers and the distance fields into r and g of distances,
+    // with pixPositions p at image pixel (p - origin) * scale. Distance fields hold the distance
+    // in image pixels to the nearest feature over maxDistance as 8 bit unorm and start out at 255,
+    // nothing in range. Called concurrently from pool threads so must only read shared state.
+    using BakeTile =
+        std::function<void(OverlayLayerImages& layers, RgbaImage& distances,
+                           const mathlib::Vec2f& origin, float scale, float maxDistance)>;
+
+    // Overlay covering [0, width) x [0, height) in pixPositions units with an atlas of
+    // atlasPages x atlasPages tiles. Each layer's tile mip levels are built with its filter from
+    // layerFilters. Distance fields cover at least maxDistance pixPositions units.
+    VirtualOverlay(ID3D11Device* device, int width, int height, float maxScale, int atlasPages,
+                   const std::array<MipFilter, overlayMaskLayers>& layerFilters,
+                   float maxDistance, BakeTile bakeTile);
+    ~VirtualOverlay();
+
+    // Choose the tiles needed for a view from eye, in pixPositions units with eyeHeight above the
+    // terrain, where a pixPositions unit at unit distance covers pixelsPerRadian screen pixels.
+    // At most as many tiles as the atlas holds are chosen, coarser than the view needs if
+    // necessary. Uploads tiles baked since the last update, requests missing ones and updates
+    // the indirection texture.
+    void update(ID3D11DeviceContext* context, const mathlib::Vec2f& eye, float eyeHeight,
+                float pixelsPerRadian);
+
+    // Replace the bake function and discard every tile baked with the old one
+    void setBakeTile(BakeTile bakeTile);
+
+    ID3D11ShaderResourceView* atlasSrv() const { return atlasSrvPtr.Get(); }
+    ID3D11ShaderResourceView* indirectionSrv() const { return indirectionSrvPtr.Get(); }
+    // DXGI_FORMAT_R8G8_UNORM distance fields with the same pages as atlasSrv()
+    ID3D11ShaderResourceView* distanceAtlasSrv() const { return distanceAtlasSrvPtr.Get(); }
+    // Level 0 size in texels in xy, tileContentSize in z and tileSize in w for the shader
+    mathlib::Vec4f shaderParameters() const;
+    // x and y such that a distance field texel of 1 in a tile of level l is a distance of
+    // x + y * 2^l pixPositions units, for the shader
+    mathlib::Vec2f distanceParameters() const;
+
+    int numResidentTiles() const { return static_cast<int>(resident.size()); }
+    int numPendingTiles() const { return static_cast<int>(pending.size()); }
+    int numNeededTiles() const { return static_cast<int>(needed.size()); }
+
+private:
+    struct Tile {
+        int level, x, y;
+    };
+    struct ResidentTile {
+        int page;
+        int lastUsedFrame;
+        std::list<uint64_t>::iterator lruPosition;
+    };
+    // Mip levels of a tile, distances as DXGI_FORMAT_R8G8_UNORM texels
+    struct BakedTile {
+        std::vector<OverlayMaskImage> masks;
+        std::vector<std::vector<uint8_t>> distances;
+    };
+    struct PendingTile {
+        Tile tile;
+        int generation;
+        std::future<BakedTile> mips;
+    };
+
+    // Distance fields cover this many texels more than maxDistance, enough to filter the coarsest
+    // tile mip level
+    static const int distanceMargin = 2 * tileBorder;
+
+    static uint64_t tileId(const Tile& tile);
+    float levelScale(int level) const;
+    // Distance in pixPositions units of a distance field texel of 1 in tiles of level
+    float distanceRange(int level) const;
+    int levelTilesX(int level) const;
+    int levelTilesY(int level) const;
+    void selectTiles(const mathlib::Vec2f& eye, float eyeHeight, float pixelsPerRadian);
+    void uploadBakedTiles(ID3D11DeviceContext* context);
+    void requestTiles();
+    int allocatePage();
+    void updateIndirection(ID3D11DeviceContext* context);
+
+    int overlayWidth;
+    int overlayHeight;
+    float finestScale;
+    int pagesPerSide;
+    float maxFieldDistance;
+    // For each of OverlayLayerImages
+    std::array<MipChainOptions, overlayMaskLayers / 4> tileMipOptions;
+    int numLevels = 1;
+    int frame = 0;
+    int generation = 0;
+    std::shared_ptr<const BakeTile> currentBakeTile;
+
+    ID3D11Texture2DPtr atlasTex;
+    ID3D11ShaderResourceViewPtr atlasSrvPtr;
+    ID3D11Texture2DPtr distanceAtlasTex;
+    ID3D11ShaderResourceViewPtr distanceAtlasSrvPtr;
+    ID3D11Texture2DPtr indirectionTex;
+    ID3D11ShaderResourceViewPtr indirectionSrvPtr;
+
+    // Tiles the current view wants, coarsest first, and the leaves of that quadtree
+    std::vector<Tile> needed;
+    std::vector<Tile> neededLeaves;
+    std::unordered_map<uint64_t, ResidentTile> resident;
+    // Resident tile ids, most recently used first
+    std::list<uint64_t> lru;
+    std::vector<int> freePages;
+    std::unordered_map<uint64_t, PendingTile> pending;
+    // Per level 0 tile (page x, page y, level, resident) as uploaded to indirectionTex
+    std::vector<uint8_t> indirection;
+};
@@ -4,9 +4,10 @@ struct TerrainParameters {
     uint4 chunkInfo;
     float2 minMaxTerrainHeight;
     float2 terrainWidthHeightMeters;
-    float4 arcLayerAlphas;
-    float4 hydroLayerAlphas;
-    float4 showContoursChunks;
+    float4 showChunks;
+    float4 overlayParameters; // level 0 size in texels, tile content texels, tile texels
+    float2 overlayDistanceParameters; // distance field range at level l is x + y * 2^l
+    float2 arcLayerWidths; // creeks and roads in heightfield pixels
 };
 
 cbuffer TerrainConstantBuffer : register(b3) {
@@ -15,8 +16,72 @@ cbuffer TerrainConstantBuffer : register(b3) {
 
 Texture2D<uint> Heights : register(t2);
 Texture2D Normals : register(t3);
-Texture2D Creeks : register(t4);
-Texture2D Lakes : register(t5);
+Texture2D<uint> Overlay : register(t4);
+Texture2D<uint4> OverlayIndirection : register(t5);
+Texture2D<float2> OverlayDistances : register(t6);
+
+// Coverage of overlay layers 0-3 in lo and 4-7 in hi from a packed texel, 2 bits per layer, see
+// overlaymask.h
+void unpackOverlayMask(uint texel, out float4 lo, out float4 hi) {
+    lo = float4((texel >> uint4(0, 2, 4, 6)) & 3u) / 3.0f;
+    hi = float4((texel >> uint4(8, 10, 12, 14)) & 3u) / 3.0f;
+}
+
+// Add weight times the bilinearly filtered layers and distance fields at atlasTexel, in level 0
+// atlas texels, from level of the atlases. Packed texels can't be filtered by the sampler so the
+// distance fields are filtered along with them.
+void sampleOverlayLevel(float2 atlasTexel, uint level, float weight, inout float4 lo,
+                        inout float4 hi, inout float2 distances) {
+    float2 texel = atlasTexel * exp2(-float(level)) - 0.5f;
+    int2 base = int2(floor(texel));
+    float2 f = texel - base;
+    float4 weights =
+        weight * float4((1 - f.x) * (1 - f.y), f.x * (1 - f.y), (1 - f.x) * f.y, f.x * f.y);
+    const int2 offsets[4] = {int2(0, 0), int2(1, 0), int2(0, 1), int2(1, 1)};
+    [unroll] for (int i = 0; i < 4; ++i) {
+        float4 texelLo, texelHi;
+        unpackOverlayMask(Overlay.Load(int3(base + offsets[i], level)), texelLo, texelHi);
+        lo += weights[i] * texelLo;
+        hi += weights[i] * texelHi;
+        distances += weights[i] * OverlayDistances.Load(int3(base + offsets[i], level));
+    }
+}
+
+// Sample the virtual overlay through the indirection entry for the level 0 tile under texCoord,
+// which gives the atlas page and level of the tile to use there. Returns layers 0-3 in lo and 4-7
+// in hi and the creek and road distances in heightfield pixels in distances, trilinearly
+// filtered.
+void sampleOverlay(float2 texCoord, out float4 lo, out float4 hi, out float2 distances) {
+    lo = float4(0.0f, 0.0f, 0.0f, 0.0f);
+    hi = float4(0.0f, 0.0f, 0.0f, 0.0f);
+    distances = float2(0.0f, 0.0f);
+    const float tileContentSize = terrainParameters.overlayParameters.z;
+    const float tileSize = terrainParameters.overlayParameters.w;
+    float2 texel = texCoord * terrainParameters.overlayParameters.xy;
+    uint4 entry = OverlayIndirection.Load(int3(texel / tileContentSize, 0));
+    // Nothing within range of the distance fields until a tile is resident
+    const float distanceRange = terrainParameters.overlayDistanceParameters.x +
+                                terrainParameters.overlayDistanceParameters.y * exp2(float(entry.z));
+    if (entry.w == 0) {
+        distances = float2(distanceRange, distanceRange);
+        return;
+    }
+    float2 levelTexel = texel * exp2(-float(entry.z));
+    float2 local = levelTexel - floor(levelTexel / tileContentSize) * tileContentSize;
+    // Skip the tile's border
+    float2 atlasTexel = entry.xy * tileSize + (tileSize - tileContentSize) * 0.5f + local;
+    // Mip level from gradients of the continuous level texel coordinate, local wraps at tile edges
+    uint width, height, mipLevels;
+    Overlay.GetDimensions(0, width, height, mipLevels);
+    float2 dx = ddx(levelTexel), dy = ddy(levelTexel);
+    float lod = clamp(0.5f * log2(max(dot(dx, dx), dot(dy, dy))), 0.0f, mipLevels - 1.0f);
+    uint level = uint(lod);
+    float blend = lod - level;
+    sampleOverlayLevel(atlasTexel, level, 1.0f - blend, lo, hi, distances);
+    if (blend > 0.0f) sampleOverlayLevel(atlasTexel, level + 1, blend, lo, hi, distances);
+    // Every mip level of a tile shares its tile level's range
+    distances *= distanceRange;
+}
 
 // Hacky experiment with raytracing shadow in pixel shader, too slow for use
 float terrainShadow(float2 texCoord, float3 lightDir) {
@@ -51,20 +116,20 @@ float4 main(in float4 Position : SV_Position, in float4 Color : COLOR0,
             in float2 TexCoord : TEXCOORD0, in float3 worldPos : TEXCOORD1, in float3 viewDir : TEXCOORD2, in float3 objectPos : TEXCOORD3) : SV_Target
 {
     float4 base = float4(0.66, 0.6, 0.6, 1.0);
-    float2 creeks = Creeks.Sample(StandardTexture, TexCoord).rg * terrainParameters.arcLayerAlphas.rg;
-    float3 lakes = Lakes.Sample(StandardTexture, TexCoord).rgb * terrainParameters.hydroLayerAlphas.rga;
-    float4 diffuse = lerp(base, float4(0.45f, 0.55f, 0.78f, 1.0f), creeks.r); // creeks
-    diffuse = lerp(diffuse, float4(0.45f, 0.55f, 0.78f, 1.0f), lakes.r); // lake outlines
-    diffuse = lerp(diffuse, float4(0.65f, 0.75f, 0.98f, 1.0f), lakes.g); // lake fill
-    diffuse = lerp(diffuse, float4(0.4f, 0.1f, 0.5f, 1.0f), lakes.b); // glaciers
-    diffuse = lerp(diffuse, float4(0.25f, 0.7f, 0.3f, 1.0f), creeks.g); // roads
-    if (terrainParameters.showContoursChunks.x > 0.0f) {
-        float contour = objectPos.y / 100;
-        contour = 0.1 - abs(round(contour) - contour);
-        contour = smoothstep(0, 0.1, contour) * abs(1.5 - Position.z);
-        diffuse = lerp(diffuse, float4(0.5f, 0.15f, 0.05f, 1.0f), contour);
-    }
-    if (terrainParameters.showContoursChunks.y > 0.0f) {
+    float4 overlay, overlayHi;
+    float2 arcDistances;
+    sampleOverlay(TexCoord, overlay, overlayHi, arcDistances);
+    // Creeks and roads are distance fields, antialias their edges over a screen pixel and keep
+    // them at least a screen pixel wide
+    float2 arcPixels = max(fwidth(arcDistances), 1e-4f);
+    float2 arcHalfWidths = max(0.5f * terrainParameters.arcLayerWidths, 0.5f * arcPixels);
+    float2 arcs = saturate((arcHalfWidths - arcDistances) / arcPixels + 0.5f);
+    float4 diffuse = lerp(base, float4(0.45f, 0.55f, 0.78f, 1.0f), max(arcs.x, overlay.y)); // creeks and lake outlines
+    diffuse = lerp(diffuse, float4(0.65f, 0.75f, 0.98f, 1.0f), overlay.z); // lake fill
+    diffuse = lerp(diffuse, float4(0.4f, 0.1f, 0.5f, 1.0f), overlay.w); // glaciers
+    diffuse = lerp(diffuse, float4(0.25f, 0.7f, 0.3f, 1.0f), arcs.y); // roads
+    diffuse = lerp(diffuse, float4(0.5f, 0.15f, 0.05f, 1.0f), overlayHi.y); // contours
+    if (terrainParameters.showChunks.x > 0.0f) {
         float chunkColor = (((terrainParameters.chunkInfo.w % terrainParameters.chunkInfo.y) & 1) ^ ((terrainParameters.chunkInfo.w / terrainParameters.chunkInfo.y) & 1)) == 0u ? 1.0f : 0.0f;
         diffuse.rgb *= 0.5f + chunkColor * 0.5f;
     }
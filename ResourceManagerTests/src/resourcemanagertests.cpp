@@ -0,0 +1,463 @@
+// Stress tests and benchmarks for ResourceManagerBase. Builds as a console program with no
+// dependencies beyond the resource manager and thread pool sources, returns non zero on failure.
+//
+// To check for data races build it with ThreadSanitizer using clang or gcc, for example:
+//   clang++ -std=c++14 -O1 -g -fsanitize=thread -I OculusFramework/src
+//       ResourceManagerTests/src/resourcemanagertests.cpp OculusFramework/src/resourcemanager.cpp
+//       OculusFramework/src/threadpool.cpp -o resourcemanagertests -pthread
+// and pass --no-benchmarks to skip the timings, which mean little under the sanitizer.
+
+#include "resourcemanager.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+void check(bool condition, const char* what) {
+    if (!condition) throw runtime_error{string{"Check failed: "} + what};
+}
+
+// Resources count themselves so tests can tell when they are freed, and poison themselves on
+// destruction so a use after free shows up as a wrong key
+atomic<int> liveResources{0};
+const uint32_t aliveMagic = 0x600dcafe;
+
+struct Resource {
+    Resource(int key_, int version_) : key{key_}, version{version_} { ++liveResources; }
+    ~Resource() {
+        magic = 0;
+        key = -2;
+        --liveResources;
+    }
+    Resource(const Resource&) = delete;
+    Resource& operator=(const Resource&) = delete;
+
+    bool alive() const { return magic == aliveMagic; }
+
+    uint32_t magic = aliveMagic;
+    int key;
+    // Which creation of the key this is, or for resources built from another that one's version
+    int version;
+};
+
+const int placeholderKey = -1;
+
+// Creates a Resource per key. failures makes the next creations of each key in it throw, or
+// return null for negative entries, to test failed async loads.
+class BaseManager : public ResourceManagerBase<int, Resource> {
+public:
+    ~BaseManager() override { finishPendingLoads(); }
+
+    void waitForLoads() { finishPendingLoads(); }
+    void failNext(int key) { failures.push_back(key); }
+    void returnNullNext(int key) { failures.push_back(-key - 1); }
+    int creations() const { return numCreations.load(); }
+    // Sleep while creating, so async loads are still in progress when getAsync() returns
+    void setCreateDelay(chrono::microseconds delay) { createDelay = delay; }
+
+private:
+    ResourceType* createResource(const KeyType& key) override {
+        if (createDelay.count()) this_thread::sleep_for(createDelay);
+        {
+            lock_guard<mutex> lock{failuresMutex};
+            auto failure = find(begin(failures), end(failures), key);
+            if (failure != end(failures)) {
+                failures.erase(failure);
+                throw runtime_error{"Creation failed"};
+            }
+            failure = find(begin(failures), end(failures), -key - 1);
+            if (failure != end(failures)) {
+                failures.erase(failure);
+                return nullptr;
+            }
+        }
+        return new Resource{key, ++numCreations};
+    }
+    ResourceType* createPlaceholder() override { return new Resource{placeholderKey, 0}; }
+
+    mutex failuresMutex;
+    vector<int> failures;
+    atomic<int> numCreations{0};
+    chrono::microseconds createDelay{0};
+};
+
+// Builds each resource from the base resource with the same key, so recreating a base resource
+// must recreate the derived one
+class DerivedManager : public ResourceManagerBase<int, Resource> {
+public:
+    explicit DerivedManager(BaseManager& base_) : base{base_} {}
+
+private:
+    ResourceType* createResource(const KeyType& key) override {
+        auto handle = base.get(key);
+        return new Resource{key, handle.get()->version};
+    }
+
+    BaseManager& base;
+};
+
+// Threads wait at arrive() until all count have, then carry on together
+class Barrier {
+public:
+    explicit Barrier(int count_) : count{count_} {}
+
+    void arrive() {
+        unique_lock<mutex> lock{barrierMutex};
+        const auto arrivedGeneration = generation;
+        if (++waiting == count) {
+            waiting = 0;
+            ++generation;
+            allArrived.notify_all();
+            return;
+        }
+        allArrived.wait(lock, [&] { return generation != arrivedGeneration; });
+    }
+
+private:
+    mutex barrierMutex;
+    condition_variable allArrived;
+    int count;
+    int waiting = 0;
+    uint64_t generation = 0;
+};
+
+void testGetAndCollect() {
+    {
+        BaseManager manager;
+        const Resource* first = nullptr;
+        {
+            auto handle = manager.get(1);
+            first = handle.get();
+            check(first->key == 1, "get() creates the resource for its key");
+            auto again = manager.get(1);
+            check(again.get() == first, "get() shares the resource between handles");
+            auto moved = move(again);
+            check(moved.get() == first, "a moved handle keeps its resource");
+        }
+        // Released in frame 0 so freed once frame retireFrames has completed
+        manager.collect(0);
+        check(liveResources == 1, "a released resource survives until it is retireFrames old");
+        {
+            auto revived = manager.get(1);
+            check(revived.get() == first, "get() revives a retired resource");
+        }
+        manager.collect(1);
+        check(liveResources == 1, "collect() keeps a resource released last frame");
+        manager.collect(2 + BaseManager::retireFrames);
+        check(liveResources == 0, "collect() frees a resource retireFrames after its release");
+        check(manager.creations() == 1, "a revived resource is not created again");
+    }
+    check(liveResources == 0, "nothing leaks");
+}
+
+void testRecreatePropagation() {
+    {
+        BaseManager base;
+        DerivedManager derived{base};
+        {
+            auto derivedHandle = derived.get(7);
+            auto baseHandle = base.get(7);
+            const auto oldBase = baseHandle.get();
+            check(derivedHandle.get()->version == oldBase->version, "derived built from base");
+
+            base.recreate(7);
+            check(baseHandle.get() != oldBase, "recreate() retargets live handles");
+            check(oldBase->alive(), "a recreated resource is retired rather than freed");
+            check(derivedHandle.get()->version == baseHandle.get()->version,
+                  "recreating a resource recreates the resources built from it");
+
+            base.recreateAll();
+            check(derivedHandle.get()->version == baseHandle.get()->version,
+                  "recreateAll() propagates to dependents");
+            base.collect(BaseManager::retireFrames);
+            derived.collect(BaseManager::retireFrames);
+            check(liveResources == 2, "collect() frees recreated resources");
+        }
+        base.collect(2 * BaseManager::retireFrames + 1);
+        derived.collect(2 * BaseManager::retireFrames + 1);
+    }
+    check(liveResources == 0, "nothing leaks");
+}
+
+void testSlots() {
+    {
+        BaseManager manager;
+        auto slot = BaseManager::SlotHandle{};
+        check(!manager.resolve(slot), "a default SlotHandle is null");
+        const Resource* resolved = nullptr;
+        {
+            auto handle = manager.get(3);
+            slot = manager.slot(handle);
+            check(manager.resolve(slot) == handle.get(), "a slot resolves to its resource");
+            manager.recreate(3);
+            check(manager.resolve(slot) == handle.get(), "recreate() updates slots");
+            resolved = manager.resolve(slot);
+        }
+        manager.collect(BaseManager::retireFrames);
+        check(!manager.resolve(slot), "a collected entry's slot resolves to null");
+        check(resolved->alive(), "a resource resolved before collect() stays valid that frame");
+        auto other = manager.get(4);
+        const auto otherSlot = manager.slot(other);
+        check(otherSlot.index == slot.index, "slots are reused");
+        check(!manager.resolve(slot), "a reused slot's old SlotHandles stay null");
+        check(manager.resolve(otherSlot) == other.get(), "a reused slot resolves its new entry");
+    }
+    check(liveResources == 0, "nothing leaks");
+}
+
+void testAsyncLoads() {
+    {
+        BaseManager manager;
+        manager.setCreateDelay(chrono::milliseconds{20});
+        {
+            auto handle = manager.getAsync(5);
+            check(handle.get()->key == placeholderKey, "getAsync() returns the placeholder");
+            auto second = manager.getAsync(5);
+            manager.waitForLoads();
+            check(handle.get()->key == 5 && second.get() == handle.get(),
+                  "a finished load retargets every handle");
+            check(manager.creations() == 1, "one load per key");
+        }
+        manager.setCreateDelay(chrono::microseconds{0});
+
+        // A failed load reports its exception and the next getAsync() loads again
+        manager.failNext(6);
+        auto failed = manager.getAsync(6);
+        manager.waitForLoads();
+        check(failed.get()->key == placeholderKey, "a failed load leaves the placeholder");
+        auto reported = false;
+        try {
+            manager.collect(0);
+        } catch (const runtime_error&) {
+            reported = true;
+        }
+        check(reported, "collect() rethrows a failed load's exception");
+        auto retried = manager.getAsync(6);
+        manager.waitForLoads();
+        check(failed.get()->key == 6 && retried.get() == failed.get(),
+              "getAsync() retries a failed load");
+
+        // As does a load that returns null
+        manager.returnNullNext(8);
+        auto null = manager.getAsync(8);
+        manager.waitForLoads();
+        reported = false;
+        try {
+            manager.collect(0);
+        } catch (const runtime_error&) {
+            reported = true;
+        }
+        check(reported && null.get()->key == placeholderKey, "a null load is reported");
+        manager.getAsync(8);
+        manager.waitForLoads();
+        check(null.get()->key == 8, "getAsync() retries a null load");
+    }
+    check(liveResources == 0, "nothing leaks");
+}
+
+// Threads get, move and destroy handles, load asynchronously and resolve slots over many frames
+// while the first thread also recreates resources and collects. Resources are checked on every
+// access, the frame barrier keeps raw pointers from outliving the frame as the manager requires.
+void testConcurrentUse() {
+    {
+        BaseManager base;
+        DerivedManager derived{base};
+        const auto numThreads = max(4, static_cast<int>(thread::hardware_concurrency()));
+        const auto numFrames = 200;
+        const auto opsPerFrame = 200;
+        const auto numKeys = 64;
+        Barrier barrier{numThreads};
+
+        const auto work = [&](int threadIndex) {
+            try {
+                auto random = mt19937{static_cast<uint32_t>(threadIndex)};
+                auto randomKey = uniform_int_distribution<int>{0, numKeys - 1};
+                auto randomOp = uniform_int_distribution<int>{0, 9};
+                auto handles = vector<pair<int, BaseManager::ResourceHandle>>{};
+                auto derivedHandles = vector<pair<int, DerivedManager::ResourceHandle>>{};
+                auto slots = vector<pair<int, BaseManager::SlotHandle>>{};
+                const auto checkResource = [](const Resource* r, int key) {
+                    check(r && r->alive(), "resources stay alive while in use");
+                    check(r->key == key || r->key == placeholderKey, "handles keep their key");
+                };
+                for (int frame = 0; frame < numFrames; ++frame) {
+                    if (threadIndex == 0) {
+                        // Everything retired up to two frames ago is freed, other threads
+                        // dropped pointers from then at the barrier
+                        if (frame > 0) {
+                            base.collect(frame - 1);
+                            derived.collect(frame - 1);
+                        }
+                        if (frame % 10 == 0) base.recreateAll();
+                        if (frame % 10 == 5) base.recreate(randomKey(random));
+                    }
+                    for (int op = 0; op < opsPerFrame; ++op) {
+                        const auto key = randomKey(random);
+                        switch (randomOp(random)) {
+                        case 0:
+                        case 1:
+                            handles.emplace_back(key, base.get(key));
+                            break;
+                        case 2:
+                            handles.emplace_back(key, base.getAsync(key));
+                            break;
+                        case 3:
+                            derivedHandles.emplace_back(key, derived.get(key));
+                            break;
+                        case 4:
+                        case 5:
+                            // Destroy a handle, moving the last one into its place
+                            if (!handles.empty()) {
+                                const auto i = static_cast<size_t>(key) % handles.size();
+                                handles[i] = move(handles.back());
+                                handles.pop_back();
+                            }
+                            if (!derivedHandles.empty() && key % 2) {
+                                const auto i = static_cast<size_t>(key) % derivedHandles.size();
+                                derivedHandles[i] = move(derivedHandles.back());
+                                derivedHandles.pop_back();
+                            }
+                            break;
+                        case 6:
+                            if (!handles.empty()) {
+                                auto& h = handles[static_cast<size_t>(key) % handles.size()];
+                                slots.emplace_back(h.first, base.slot(h.second));
+                            }
+                            break;
+                        case 7:
+                            for (const auto& s : slots) {
+                                const auto r = base.resolve(s.second);
+                                if (r) checkResource(r, s.first);
+                            }
+                            break;
+                        default:
+                            for (auto& h : handles) checkResource(h.second.get(), h.first);
+                            for (auto& h : derivedHandles) checkResource(h.second.get(), h.first);
+                            break;
+                        }
+                    }
+                    if (handles.size() > 256) handles.erase(begin(handles), begin(handles) + 128);
+                    if (slots.size() > 256) slots.erase(begin(slots), begin(slots) + 128);
+                    barrier.arrive();
+                }
+                handles.clear();
+                derivedHandles.clear();
+            } catch (const exception& e) {
+                // The other threads would wait at the barrier forever
+                cerr << e.what() << "\n";
+                abort();
+            }
+        };
+        auto threads = vector<thread>{};
+        for (int i = 1; i < numThreads; ++i) threads.emplace_back(work, i);
+        work(0);
+        for (auto& t : threads) t.join();
+
+        base.waitForLoads();
+        derived.collect(numFrames + BaseManager::retireFrames);
+        base.collect(numFrames + BaseManager::retireFrames);
+    }
+    check(liveResources == 0, "nothing leaks");
+}
+
+template <typename F>
+double nanosecondsPer(int count, F f) {
+    const auto start = chrono::high_resolution_clock::now();
+    f();
+    const auto elapsed = chrono::high_resolution_clock::now() - start;
+    return chrono::duration<double, nano>{elapsed}.count() / count;
+}
+
+// Cost of get() and handle destruction from several threads, spread over many keys and all on one
+void benchmarkContention() {
+    BaseManager manager;
+    const auto numKeys = 1024;
+    auto keep = vector<BaseManager::ResourceHandle>{};
+    for (int key = 0; key < numKeys; ++key) keep.push_back(manager.get(key));
+    const auto opsPerThread = 200000;
+    cout << "get() and destroy, ns per op per thread\n";
+    const auto maxThreads = max(4, static_cast<int>(thread::hardware_concurrency()));
+    for (int numThreads = 1; numThreads <= maxThreads; numThreads *= 2) {
+        for (const auto sameKey : {false, true}) {
+            const auto time = nanosecondsPer(opsPerThread, [&] {
+                auto threads = vector<thread>{};
+                for (int t = 0; t < numThreads; ++t) {
+                    threads.emplace_back([&manager, t, sameKey] {
+                        for (int i = 0; i < opsPerThread; ++i)
+                            manager.get(sameKey ? 0 : (i * 7 + t * 131) % numKeys);
+                    });
+                }
+                for (auto& t : threads) t.join();
+            });
+            cout << "  " << numThreads << (numThreads == 1 ? " thread, " : " threads, ")
+                 << (sameKey ? "one key: " : "spread keys: ") << time << "\n";
+        }
+    }
+}
+
+// Cost of replacing and moving handles to one resource against how many handles it has. Each
+// replaced handle is picked at random so it is anywhere in the resource's list of handles. Cost
+// should stay flat until the handles no longer fit in cache.
+void benchmarkHandleCount() {
+    BaseManager manager;
+    const auto ops = 200000;
+    cout << "Handles to one resource, ns per replace and per move there and back\n";
+    for (const auto numHandles : {10, 1000, 100000, 1000000}) {
+        auto handles = vector<BaseManager::ResourceHandle>{};
+        handles.reserve(numHandles);
+        for (int i = 0; i < numHandles; ++i) handles.push_back(manager.get(0));
+        auto random = mt19937{};
+        auto indices = vector<size_t>(ops);
+        auto randomIndex = uniform_int_distribution<size_t>{0, handles.size() - 1};
+        for (auto& i : indices) i = randomIndex(random);
+        const auto replace = nanosecondsPer(ops, [&] {
+            for (const auto i : indices) handles[i] = manager.get(0);
+        });
+        const auto moveBack = nanosecondsPer(ops, [&] {
+            for (const auto i : indices) {
+                auto moved = move(handles[i]);
+                handles[i] = move(moved);
+            }
+        });
+        cout << "  " << numHandles << " handles: " << replace << ", " << moveBack << "\n";
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    auto benchmarks = true;
+    for (int i = 1; i < argc; ++i)
+        if (strcmp(argv[i], "--no-benchmarks") == 0) benchmarks = false;
+    try {
+        testGetAndCollect();
+        testRecreatePropagation();
+        testSlots();
+        testAsyncLoads();
+        testConcurrentUse();
+        cout << "All tests passed\n";
+        if (benchmarks) {
+            benchmarkContention();
+            benchmarkHandleCount();
+        }
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}